@@ -13,38 +13,81 @@
 #include <stdarg.h>
 #include <fcntl.h>
 #include <ctype.h>
+#include <libgen.h>
+#include <signal.h>
+#include <sys/stat.h>
 
 #include "stringbuffer.h"
 #include "terminal.h"
+#include "fileio.h"
+#include "screen.h"
+#include "eventloop.h"
+#include "prefixsum.h"
+#include "utf8.h"
+#include "input.h"
+#include "latency.h"
+#include "output.h"
+#include "search.h"
+#include "searchpool.h"
+#include "regex.h"
 
 #define ATTO_VERSION "0.0.1"
 #define EDITOR_ROW_DECORATOR "~"
 #define EDITOR_ROW_DECORATOR_LEN 1
-#define ESC_CHAR '\x1b'
 #define CTRL_KEY(k) ((k)&0x1f)
 #define TAB_STOP 8
 #define QUIT_TIMES 2
+#define SAVE_CHUNK_SIZE (1 << 20)
+#define MAX_FRAME_INTERVAL_MS 33
+#define STATUS_MESSAGE_TIMEOUT_MS 5000
+#define REWRAP_CHUNK_ROWS 4096
+#define ESC_TIMEOUT_MS 100
+#define RESIZE_DEBOUNCE_MS 50
+// rows whose matches are kept, more than a screen shows
+#define HIGHLIGHT_CACHE_ROWS 256
+
+enum SaveDurability
+{
+    DURABILITY_NONE,
+    DURABILITY_DATA,
+    DURABILITY_FULL
+};
 
-enum EditorKey
-{
-    BACKSPACE = 127,
-    ARROW_UP = 1000,
-    ARROW_DOWN,
-    ARROW_LEFT,
-    ARROW_RIGHT,
-    PAGE_UP,
-    PAGE_DOWN,
-    HOME_KEY,
-    END_KEY,
-    DEL_KEY
+// cycled by Ctrl+T in the search prompt
+enum FindCase
+{
+    FIND_MATCH_CASE,
+    FIND_SMART_CASE, // ignore the case unless the query has an upper case letter
+    FIND_IGNORE_CASE
 };
 
+/*
+* A char whose render width differs from its length in the text : a tab, a
+* multi-byte UTF-8 sequence, a wide or a zero width char.
+* Between two stops, one byte of text is one byte and one column of render.
+*/
+typedef struct RowStop
+{
+    int at;           // index of the char in text
+    int col;          // render column it starts at
+    int renderAt;     // index of the char in render
+    int nextAt;       // index of the following char in text
+    int nextCol;      // render column the following char starts at
+    int nextRenderAt; // index of the following char in render
+} RowStop;
+
 typedef struct TextRow
 {
     int len;
     char *text;
-    int renderLen;
-    char *render;
+    int renderLen;  // in bytes
+    int renderCols; // in screen columns
+    char *render;   // UTF-8 text with the tabs expanded
+    off_t diskOffset; // offset of the row in the file on disk, -1 if modified since
+    int stopsCount;
+    RowStop *stops; // sorted by position, computed by editorUpdateRow
+    int wrapCount;  // screen lines taken in soft wrap mode
+    int wrapWidth;  // screen width wrapCount was computed for, 0 when stale
 } TextRow;
 
 typedef struct Document
@@ -53,10 +96,48 @@ typedef struct Document
     TextRow *rows;
     int rowOffset;
     int colOffset;
+    int wrapOffset; // first screen line of rows[rowOffset] shown in soft wrap mode
+    PrefixSum wrapIndex; // rows wrapCount, rebuilt when rows are inserted or deleted
+    int wrapIndexValid;
+    int rewrapNext; // next row to rewrap in the background, -1 when all are up to date
     char *filename;
     int dirty;
+    unsigned long version; // incremented by every edit, caches of the rows compare it
+    struct stat diskStat; // file on disk the rows diskOffset refer to
+    int hasDiskStat;
 } Document;
 
+// a hit of the highlighted query, in render columns
+typedef struct MatchSpan
+{
+    int col;
+    int endCol;
+} MatchSpan;
+
+typedef struct HighlightRow
+{
+    int at; // document row the spans belong to, -1 if none
+    int count;
+    int size;
+    MatchSpan *spans;
+} HighlightRow;
+
+/*
+* Hits of the search query in the rows drawn, cached by row index (direct
+* mapped) and dropped when the query or the document version change : the
+* cost follows the rows on screen, not the size of the document.
+*/
+typedef struct Highlight
+{
+    char *query; // NULL when nothing is highlighted
+    size_t queryLen;
+    int flags;   // SEARCH_REGEX when query was compiled to regex, SEARCH_IGNORE_CASE
+    Regex regex;
+    RegexMatcher matcher;
+    unsigned long version;
+    HighlightRow rows[HIGHLIGHT_CACHE_ROWS];
+} Highlight;
+
 typedef struct EditorConfig
 {
     struct termios origTermios;
@@ -65,8 +146,43 @@ typedef struct EditorConfig
     int cursorX;
     int cursorY;
     int cursorRenderX;
+    int cursorScreenRow;
+    int cursorScreenCol;
+    int softWrap;
     char statusMessage[80];
-    time_t statusMessageTime;
+    double statusMessageTime;
+    int prompting; // the status message is a prompt and does not expire
+    enum SaveDurability durability;
+    Screen screen;
+    StringBuffer frame; // kept across frames so that redraws do not allocate
+    OutputWriter output;
+    int frameInFlight; // submitted to the writer thread and not known to be written yet
+    int redrawPending; // a frame was skipped while the previous one was written
+    int synchronizedOutput;
+    long drawnTopLine;
+    int drawnColOffset;
+    EventLoop events;
+    int messageTimerFd;
+    int autosaveTimerFd;
+    int autosaveInterval; // seconds, 0 when disabled
+    int resizeFd;
+    int resizeTimerFd; // armed by the first SIGWINCH of a burst
+    int resizePending;
+    KeyQueue keys;      // filled by the input thread
+    StringBuffer paste; // text of the last PASTE_START key read
+    LatencyTracker latency;
+    int latencyOverlay; // show the latency histograms on top of the text
+    int latencyReport;  // print the latency histograms on exit
+    SearchPool search;
+    int searching;      // the find prompt waits for the first hit of a search
+    int findLastMatch;  // row of the last hit, -1 for a new query
+    int findDirection;  // down = 1, up = -1
+    int findFlags;      // SEARCH_REGEX for a regex search
+    enum FindCase findCase;
+    char findPrompt[64];
+    int replacing; // the find prompt reads the query of editorReplace
+    const char *findError; // why the last regex query did not compile, NULL if it did
+    Highlight highlight;
 } EditorConfig;
 
 EditorConfig config;
@@ -76,35 +192,57 @@ static int editorReadKey();
 static void die(const char *message);
 static void initEditor();
 static void editorRefreshScreen();
+static int editorFrameDone();
 static void editorProcessKeyPress();
 static void editorUpdateRow(TextRow *row);
-static void editorDrawRows(StringBuffer *sb);
+static void editorDrawRows(Screen *screen);
 static void editorMoveCursor(int key);
-static void centerText(StringBuffer *sb, const char *text, int len);
+static void centerText(Screen *screen, const int row, const char *text, int len);
 static void editorOpen(const char *filename);
+static void editorInitRow(TextRow *row, char *text, size_t len);
 static void editorInsertRow(const int at, const char *s, size_t len);
 static void editorScroll();
+static void editorScrollWrapped();
+static int editorRowWrapCount(const int at);
+static int editorNextWrapCol(const TextRow *row, int fromCol);
+static int editorWrapSegmentCol(const TextRow *row, int segment);
+static int editorWrapSegment(const TextRow *row, int cursorRenderX);
+static void editorRewrapChunk();
+static void editorToggleSoftWrap();
 static int editorCursorXToCursorRenderX(const TextRow *row, int cursorX);
 static int editorCursorRenderXToCursorX(const TextRow *row, int cursorRenderX);
-static void editorDrawStatusBar(StringBuffer *sb);
-static void editorDrawMessageBar(StringBuffer *sb);
+static int editorFindStopByCursorRenderX(const TextRow *row, int cursorRenderX);
+static int editorPreviousCharX(const TextRow *row, int cursorX);
+static int editorNextCharX(const TextRow *row, int cursorX);
+static void editorDrawStatusBar(Screen *screen);
+static void editorDrawMessageBar(Screen *screen);
 static void editorSetStatusMessage(const char *fmt, ...);
 static void editorInsertCharAtRow(const char c, int at, TextRow *row);
 static void editorInsertChar(const char c);
-static char *editorRowsToString(int *bufferLen);
+static off_t editorWriteRows(const int fd, const int diskFd, double *serializeMs, double *writeMs, off_t *copied);
+static int editorCreateTempFile(char **tmpPath, const struct stat *st);
 static void editorSave();
+static int editorSyncFile(const int fd);
+static int editorSyncDirectory();
+static int editorOpenDiskFile();
 static void editorDelCharAtRow(const int at, TextRow *row);
 static void editorDelChar();
 static void editorFreeRow(TextRow *row);
 static void editorDelRow(const int at);
 static void editorAppendStringToRow(const char *s, const size_t len, TextRow *row);
 static void editorInsertNewLine();
-static char *editorPrompt(const char *prompt, void (*callback)(char *, int));
-static void editorFind();
+static void editorInsertText(const char *s, size_t len);
+static void editorReadPaste(StringBuffer *paste);
+static char *editorPrompt(const char *prompt, void (*callback)(char *, int), int allowEmpty);
+static void editorFind(int flags);
+static void editorReplace();
 static void editorFindCallBack(char *query, int key);
+static void editorOnSearchDone(int fd);
+static void editorDrawLatencyOverlay(Screen *screen);
 
 static void die(const char *message)
 {
+    outputDrain(&config.output);
     clearScreeen();
 
     perror(message);
@@ -113,11 +251,21 @@ static void die(const char *message)
 
 static void resetTerminal()
 {
+    disableBracketedPaste();
+
     if (disableRawMode(&config.origTermios) != 0)
         die("disableRawMode");
 }
 
-static void centerText(StringBuffer *sb, const char *text, int len)
+static double monotonicMs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void centerText(Screen *screen, const int row, const char *text, int len)
 {
     if (len > config.screenCols)
         len = config.screenCols;
@@ -125,14 +273,9 @@ static void centerText(StringBuffer *sb, const char *text, int len)
     int centerPadding = (config.screenCols - len) / 2;
 
     if (centerPadding > 0)
-    {
-        sbAppend(sb, EDITOR_ROW_DECORATOR, EDITOR_ROW_DECORATOR_LEN);
-
-        while (--centerPadding)
-            sbAppend(sb, " ", 1);
-    }
+        screenPut(screen, row, 0, EDITOR_ROW_DECORATOR, EDITOR_ROW_DECORATOR_LEN, SCREEN_ATTR_NORMAL);
 
-    sbAppend(sb, text, len);
+    screenPut(screen, row, centerPadding, text, len, SCREEN_ATTR_NORMAL);
 }
 
 static void editorSetStatusMessage(const char *fmt, ...)
@@ -141,25 +284,84 @@ static void editorSetStatusMessage(const char *fmt, ...)
     va_start(ap, fmt);
     vsnprintf(config.statusMessage, sizeof(config.statusMessage), fmt, ap);
     va_end(ap);
-    config.statusMessageTime = time(NULL);
+    config.statusMessageTime = monotonicMs();
+
+    // redraw without the message once it expired
+    if (config.messageTimerFd != -1)
+        timerArm(config.messageTimerFd, STATUS_MESSAGE_TIMEOUT_MS, 0);
 }
 
-static void editorDrawMessageBar(StringBuffer *sb)
+static unsigned char sgrToAttr(const unsigned char attr, const int param)
 {
-    sbAppend(sb, "\x1b[K", 3);
+    switch (param)
+    {
+    case 0:
+        return SCREEN_ATTR_NORMAL;
+    case 1:
+        return attr | SCREEN_ATTR_BOLD;
+    case 5:
+        return attr | SCREEN_ATTR_BLINK;
+    case 7:
+        return attr | SCREEN_ATTR_REVERSE;
+    default:
+        return attr;
+    }
+}
 
-    int len = strlen(config.statusMessage);
+/*
+* The status message may embed SGR sequences (e.g. \x1b[1;5m), they are
+* translated into cell attributes.
+*/
+static void editorDrawMessageBar(Screen *screen)
+{
+    const int row = config.screenRows + 1;
 
-    if (len > config.screenCols)
-        len = config.screenCols;
+    if (!config.prompting && monotonicMs() - config.statusMessageTime >= STATUS_MESSAGE_TIMEOUT_MS)
+        return;
+
+    unsigned char attr = SCREEN_ATTR_NORMAL;
+    int col = 0;
+
+    for (const char *c = config.statusMessage; *c && col < config.screenCols; c++)
+    {
+        if (c[0] != ESC_CHAR || c[1] != '[')
+        {
+            // put the whole run of text up to the next escape sequence at once
+            const char *end = strchr(c + 1, ESC_CHAR);
+
+            if (!end)
+                end = c + strlen(c);
+
+            col = screenPut(screen, row, col, c, end - c, attr);
+            c = end - 1;
+            continue;
+        }
+
+        int param = 0;
+
+        for (c += 2; *c && *c != 'm'; c++)
+        {
+            if (isdigit(*c))
+            {
+                param = param * 10 + (*c - '0');
+            }
+            else
+            {
+                attr = sgrToAttr(attr, param);
+                param = 0;
+            }
+        }
+
+        if (!*c)
+            break;
 
-    if (len && time(NULL) - config.statusMessageTime < 5)
-        sbAppend(sb, config.statusMessage, len);
+        attr = sgrToAttr(attr, param);
+    }
 }
 
-static void editorDrawStatusBar(StringBuffer *sb)
+static void editorDrawStatusBar(Screen *screen)
 {
-    sbAppend(sb, "\x1b[7m", 4);
+    const int row = config.screenRows;
 
     char status[80];
     int len = snprintf(status, sizeof(status), "%.20s - %d lines %s",
@@ -173,333 +375,927 @@ static void editorDrawStatusBar(StringBuffer *sb)
     if (len > config.screenCols)
         len = config.screenCols;
 
-    sbAppend(sb, status, len);
-
-    while (len < config.screenCols)
-    {
-        if (config.screenCols - len == rLen)
-        {
-            sbAppend(sb, rStatus, rLen);
-            break;
-        }
-        else
-        {
-            sbAppend(sb, " ", 1);
-            len++;
-        }
-    }
+    screenFill(screen, row, 0, ' ', config.screenCols, SCREEN_ATTR_REVERSE);
+    screenPut(screen, row, 0, status, len, SCREEN_ATTR_REVERSE);
 
-    sbAppend(sb, "\x1b[m", 3);
-    sbAppend(sb, "\r\n", 2);
+    if (config.screenCols - len >= rLen)
+        screenPut(screen, row, config.screenCols - rLen, rStatus, rLen, SCREEN_ATTR_REVERSE);
 }
 
-static void editorDrawWelcome(StringBuffer *sb)
+static void editorDrawWelcome(Screen *screen, const int row)
 {
     const char *TITLE = "ATTO editor";
-    centerText(sb, TITLE, strlen(TITLE));
-    sbAppend(sb, "\r\n", 2);
+    centerText(screen, row, TITLE, strlen(TITLE));
 
     char version[40] = "version ";
     strcat(version, ATTO_VERSION);
-    centerText(sb, version, strlen(version));
+    centerText(screen, row + 1, version, strlen(version));
 }
 
-static void initEditor()
+static int editorUpdateWindowSize()
 {
-    config.cursorX = 0;
-    config.cursorY = 0;
-    config.cursorRenderX = 0;
-    config.statusMessage[0] = '\0';
-    config.statusMessageTime = 0;
+    int rows;
+    int cols;
 
-    if (getWindowSize(&config.screenRows, &config.screenCols) == -1)
-        die("getWindowSize");
+    if (getWindowSize(&rows, &cols) == -1)
+        return -1;
+
+    screenResize(&config.screen, rows, cols);
 
     //keep room for a status bar and a status message
-    config.screenRows -= 2;
+    config.screenRows = rows - 2;
+    config.screenCols = cols;
 
-    document.rowsCount = 0;
-    document.rows = NULL;
-    document.rowOffset = 0;
-    document.colOffset = 0;
-    document.filename = NULL;
-    document.dirty = 0;
+    return 0;
 }
 
-static int editorReadKey()
+static void editorOnMessageTimeout(int fd)
+{
+    timerAck(fd);
+    editorRefreshScreen();
+}
+
+static void editorOnAutosave(int fd)
+{
+    timerAck(fd);
+
+    // never prompt for a file name, nor save in the middle of a prompt
+    if (config.prompting || !document.dirty || document.filename == NULL)
+        return;
+
+    editorSave();
+    editorRefreshScreen();
+}
+
+/*
+* A burst of SIGWINCH (e.g. while dragging the window border) only leads to
+* one relayout every RESIZE_DEBOUNCE_MS, with the size at that time.
+*/
+static void editorOnResize(int fd)
 {
-    int nread;
-    char c;
+    signalAck(fd);
 
-    while ((nread = read(STDIN_FILENO, &c, 1)) != 1)
+    if (!config.resizePending)
     {
-        if (nread == -1 && errno != EAGAIN)
-            die("read");
+        config.resizePending = 1;
+        timerArm(config.resizeTimerFd, RESIZE_DEBOUNCE_MS, 0);
     }
+}
 
-    if (c == ESC_CHAR)
-    {
-        char seq[3];
+static void editorOnResizeTimeout(int fd)
+{
+    timerAck(fd);
+    config.resizePending = 0;
 
-        if (read(STDIN_FILENO, &seq[0], 1) != 1)
-            return ESC_CHAR;
-        if (read(STDIN_FILENO, &seq[1], 1) != 1)
-            return ESC_CHAR;
+    if (editorUpdateWindowSize() != 0)
+        return;
 
-        if (seq[0] == '[')
-        {
-            if (seq[1] >= '0' && seq[1] <= '9')
-            {
-                if (read(STDIN_FILENO, &seq[2], 1) != 1)
-                    return ESC_CHAR;
+    if (config.softWrap)
+    {
+        // only the rows on screen are rewrapped by the next frame, the others in the background
+        if (document.rowOffset < document.rowsCount &&
+            document.wrapOffset >= editorRowWrapCount(document.rowOffset))
+            document.wrapOffset = editorRowWrapCount(document.rowOffset) - 1;
 
-                if (seq[2] == '~')
-                {
-                    switch (seq[1])
-                    {
-                    case '1':
-                        return HOME_KEY;
-                    case '3':
-                        return DEL_KEY;
-                    case '4':
-                        return END_KEY;
-                    case '5':
-                        return PAGE_UP;
-                    case '6':
-                        return PAGE_DOWN;
-                    case '7':
-                        return HOME_KEY;
-                    case '8':
-                        return END_KEY;
-                    }
-                }
-            }
-            else
-            {
-                switch (seq[1])
-                {
-                case 'A':
-                    return ARROW_UP;
-                case 'B':
-                    return ARROW_DOWN;
-                case 'C':
-                    return ARROW_RIGHT;
-                case 'D':
-                    return ARROW_LEFT;
-                case 'H':
-                    return HOME_KEY;
-                case 'F':
-                    return END_KEY;
-                }
-            }
-        }
-        else if (seq[0] == 'O')
-        {
-            switch (seq[1])
-            {
-            case 'H':
-                return HOME_KEY;
-            case 'F':
-                return END_KEY;
-            }
-        }
-        else
-        {
-            return ESC_CHAR;
-        }
+        document.rewrapNext = 0;
     }
 
-    return c;
+    editorRefreshScreen();
 }
 
-static void editorScroll()
+/*
+* Whether the last frame was written, noticed either here or by the next
+* redraw during a burst of keys, whichever comes first.
+*/
+static int editorFrameDone()
 {
-    config.cursorRenderX = 0;
-
-    if (config.cursorY < document.rowsCount)
-        config.cursorRenderX = editorCursorXToCursorRenderX(
-            &document.rows[config.cursorY], config.cursorX);
-
-    if (config.cursorRenderX < document.colOffset)
-        document.colOffset = config.cursorRenderX;
+    if (config.frameInFlight && !outputBusy(&config.output))
+    {
+        config.frameInFlight = 0;
+        latencyFrameWritten(&config.latency, monotonicMs());
+    }
 
-    if (config.cursorRenderX >= document.colOffset + config.screenCols)
-        document.colOffset = config.cursorRenderX - config.screenCols + 1;
+    return !config.frameInFlight;
+}
 
-    if (config.cursorY < document.rowOffset)
-        document.rowOffset = config.cursorY;
+static void editorOnFrameWritten(int fd)
+{
+    (void)fd;
+    outputAck(&config.output);
 
-    if (config.cursorY >= document.rowOffset + config.screenRows)
-        document.rowOffset = config.cursorY - config.screenRows + 1;
+    if (editorFrameDone() && config.redrawPending)
+        editorRefreshScreen();
 }
 
-static int editorCursorXToCursorRenderX(const TextRow *row, int cursorX)
+static void editorOnKeyQueued(int fd)
 {
-    int cursorRenderX = 0;
+    (void)fd;
+    keyQueueAck(&config.keys);
+}
 
-    for (int i = 0; i < cursorX; i++)
+/*
+* Sleep in the event loop, serving timers and signals, until the input
+* thread queued a key.
+*/
+static void editorWaitForInput()
+{
+    while (keyQueueEmpty(&config.keys))
     {
-        if (row->text[i] == '\t')
-            cursorRenderX += (TAB_STOP - 1) - (cursorRenderX % TAB_STOP);
+        // rewrapping is done in chunks between events
+        if (eventLoopRun(&config.events, document.rewrapNext == -1 ? -1 : 0) == -1)
+            die("epoll_wait");
 
-        cursorRenderX++;
+        if (document.rewrapNext != -1)
+            editorRewrapChunk();
     }
+}
 
-    return cursorRenderX;
+// a key can be read without waiting
+static int editorKeyPending()
+{
+    return !keyQueueEmpty(&config.keys);
 }
 
-static int editorCursorRenderXToCursorX(const TextRow *row, int cursorRenderX)
+static void initEditor()
 {
-    int currentCursorRenderX = 0;
+    config.cursorX = 0;
+    config.cursorY = 0;
+    config.cursorRenderX = 0;
+    config.statusMessage[0] = '\0';
+    config.statusMessageTime = 0;
+    config.cursorScreenRow = 0;
+    config.cursorScreenCol = 0;
+    config.softWrap = 0;
+    config.drawnTopLine = 0;
+    config.drawnColOffset = 0;
+    config.frame = (StringBuffer)SB_INIT;
+    config.prompting = 0;
+    config.frameInFlight = 0;
+    config.redrawPending = 0;
+    config.searching = 0;
+    config.findLastMatch = -1;
+    config.findDirection = 1;
+    config.findFlags = 0;
+    config.findCase = FIND_MATCH_CASE;
+    config.replacing = 0;
+    config.findError = NULL;
+    config.highlight.query = NULL;
+    config.highlight.flags = 0;
+    config.highlight.version = 0;
+
+    for (int i = 0; i < HIGHLIGHT_CACHE_ROWS; i++)
+        config.highlight.rows[i] = (HighlightRow){-1, 0, 0, NULL};
+
+    if (editorUpdateWindowSize() == -1)
+        die("getWindowSize");
 
-    int cursorX;
+    config.synchronizedOutput = querySynchronizedOutput();
 
-    for (cursorX = 0; cursorX < row->len; cursorX++)
-    {
-        if (row->text[cursorX] == '\t')
-            currentCursorRenderX += (TAB_STOP - 1) - (currentCursorRenderX % TAB_STOP);
+    config.messageTimerFd = timerCreate();
+    config.autosaveTimerFd = timerCreate();
+    config.resizeFd = signalCreate(SIGWINCH);
+    config.resizeTimerFd = timerCreate();
+    config.resizePending = 0;
+    config.paste = (StringBuffer)SB_INIT;
 
-        currentCursorRenderX++;
+    // started once the terminal queries above are answered, the thread owns stdin from now on
+    if (keyQueueInit(&config.keys) == -1 || inputStartThread(&config.keys, STDIN_FILENO, ESC_TIMEOUT_MS) == -1)
+        die("inputThread");
 
-        if (currentCursorRenderX > cursorRenderX)
-            return cursorX;
-    }
+    if (outputStart(&config.output, STDOUT_FILENO) == -1)
+        die("outputThread");
 
-    return cursorX;
+    if (searchPoolInit(&config.search) == -1)
+        die("searchPool");
+
+    if (eventLoopInit(&config.events) == -1 ||
+        config.messageTimerFd == -1 || config.autosaveTimerFd == -1 ||
+        config.resizeFd == -1 || config.resizeTimerFd == -1 ||
+        eventLoopAdd(&config.events, config.keys.wakeFd, editorOnKeyQueued) == -1 ||
+        eventLoopAdd(&config.events, config.output.doneFd, editorOnFrameWritten) == -1 ||
+        eventLoopAdd(&config.events, config.search.doneFd, editorOnSearchDone) == -1 ||
+        eventLoopAdd(&config.events, config.messageTimerFd, editorOnMessageTimeout) == -1 ||
+        eventLoopAdd(&config.events, config.autosaveTimerFd, editorOnAutosave) == -1 ||
+        eventLoopAdd(&config.events, config.resizeFd, editorOnResize) == -1 ||
+        eventLoopAdd(&config.events, config.resizeTimerFd, editorOnResizeTimeout) == -1)
+        die("eventLoop");
+
+    if (config.autosaveInterval > 0)
+        timerArm(config.autosaveTimerFd, config.autosaveInterval * 1000L, config.autosaveInterval * 1000L);
+
+    document.rowsCount = 0;
+    document.rows = NULL;
+    document.rowOffset = 0;
+    document.colOffset = 0;
+    document.wrapOffset = 0;
+    document.wrapIndex.count = 0;
+    document.wrapIndex.tree = NULL;
+    document.wrapIndexValid = 0;
+    document.rewrapNext = -1;
+    document.filename = NULL;
+    document.dirty = 0;
+    document.version = 0;
+    document.hasDiskStat = 0;
 }
 
-static void editorRefreshScreen()
+/*
+* Take the text of the bracketed paste read with the last PASTE_START key.
+*/
+static void editorReadPaste(StringBuffer *paste)
 {
-    editorScroll();
+    *paste = config.paste;
+    config.paste = (StringBuffer)SB_INIT;
+}
 
-    StringBuffer sb = SB_INIT;
+/*
+* Keys are read and decoded by the input thread, see inputStartThread.
+*/
+static int editorReadKey()
+{
+    KeyEvent event;
 
-    clearScreeen();
-    editorDrawRows(&sb);
-    editorDrawStatusBar(&sb);
-    editorDrawMessageBar(&sb);
+    while (!keyQueuePop(&config.keys, &event))
+        editorWaitForInput();
 
-    char cursorBuf[32];
-    snprintf(cursorBuf, sizeof(cursorBuf), "\x1b[%d;%dH",
-             (config.cursorY - document.rowOffset) + 1,
-             (config.cursorRenderX - document.colOffset) + 1);
+    latencyKeyRead(&config.latency, event.readTime);
 
-    sbAppend(&sb, cursorBuf, strlen(cursorBuf));
-    write(STDOUT_FILENO, sb.s, sb.len);
-    sbFree(&sb);
+    if (event.key == READ_ERROR)
+    {
+        errno = event.error;
+        die("read");
+    }
+
+    if (event.key == PASTE_START)
+    {
+        sbFree(&config.paste);
+        config.paste.s = event.paste;
+        config.paste.len = event.pasteLen;
+        config.paste.cap = event.pasteLen;
+    }
+
+    return event.key;
 }
 
-static void editorInsertCharAtRow(const char c, int at, TextRow *row)
+/*
+* Render column the wrap segment after the one starting at fromCol starts at.
+* A wide char cut by the right edge of the screen starts the next segment
+* instead, the last column of its own is left blank.
+*/
+static int editorNextWrapCol(const TextRow *row, int fromCol)
 {
-    if (at < 0 || at > row->len)
-        at = row->len;
+    int col = fromCol + config.screenCols;
+    int i = col < row->renderCols ? editorFindStopByCursorRenderX(row, col) : -1;
 
-    row->text = realloc(row->text, row->len + 2);
-    memmove(&row->text[at + 1], &row->text[at], row->len - at + 1);
-    row->len++;
-    row->text[at] = c;
+    if (i != -1)
+    {
+        const RowStop *stop = &row->stops[i];
 
-    editorUpdateRow(row);
-    document.dirty++;
+        if (stop->col < col && col < stop->nextCol && stop->col > fromCol && row->text[stop->at] != '\t')
+            return stop->col;
+    }
+
+    return col;
 }
 
-static void editorDelCharAtRow(const int at, TextRow *row)
+// render column the given wrap segment of a row starts at
+static int editorWrapSegmentCol(const TextRow *row, int segment)
 {
-    if (at < 0 || at > row->len)
-        return;
+    if (row->stopsCount == 0)
+        return segment * config.screenCols;
 
-    memmove(&row->text[at], &row->text[at + 1], row->len - at);
-    row->len--;
+    int col = 0;
 
-    editorUpdateRow(row);
-    document.dirty++;
+    while (segment-- > 0)
+        col = editorNextWrapCol(row, col);
+
+    return col;
 }
 
-static void editorDelChar()
+// wrap segment of a row holding the render column cursorRenderX
+static int editorWrapSegment(const TextRow *row, int cursorRenderX)
 {
-    if (config.cursorY == document.rowsCount)
-        return;
+    if (row->stopsCount == 0)
+        return cursorRenderX / config.screenCols;
 
-    if (config.cursorX == 0 && config.cursorY == 0)
-        return;
+    int segment = 0;
 
-    TextRow *row = &document.rows[config.cursorY];
+    for (int col = editorNextWrapCol(row, 0); col <= cursorRenderX; col = editorNextWrapCol(row, col))
+        segment++;
 
-    if (config.cursorX > 0)
-    {
-        editorDelCharAtRow(config.cursorX, row);
-        config.cursorX--;
-    }
-    else
+    return segment;
+}
+
+static int editorRowWrapCount(const int at)
+{
+    TextRow *row = &document.rows[at];
+
+    if (row->wrapWidth != config.screenCols)
     {
-        config.cursorX = document.rows[config.cursorY - 1].len;
-        editorAppendStringToRow(row->text, row->len, &document.rows[config.cursorY - 1]);
-        editorDelRow(config.cursorY);
-        config.cursorY--;
+        int count = editorWrapSegment(row, row->renderCols ? row->renderCols - 1 : 0) + 1;
+
+        if (document.wrapIndexValid)
+            prefixSumAdd(&document.wrapIndex, at, count - row->wrapCount);
+
+        row->wrapCount = count;
+        row->wrapWidth = config.screenCols;
     }
+
+    return row->wrapCount;
 }
 
-static void editorFreeRow(TextRow *row)
+static int editorRowCachedWrapCount(int at)
 {
-    free(row->render);
-    free(row->text);
+    return document.rows[at].wrapCount;
 }
 
-static void editorDelRow(const int at)
+static PrefixSum *editorWrapIndex()
 {
-    if (at < 0 || at > document.rowsCount)
-        return;
-
-    editorFreeRow(&document.rows[at]);
-    memmove(&document.rows[at],
-            &document.rows[at + 1],
-            sizeof(TextRow) * (document.rowsCount - at + 1));
+    if (!document.wrapIndexValid)
+    {
+        prefixSumBuild(&document.wrapIndex, document.rowsCount, editorRowCachedWrapCount);
+        document.wrapIndexValid = 1;
+    }
 
-    document.rowsCount--;
-    document.dirty++;
+    return &document.wrapIndex;
 }
 
-static void editorAppendStringToRow(const char *s, const size_t len, TextRow *row)
+// screen line of the top of the viewport, counted from the start of the document
+static long editorTopLine()
 {
-    row->text = realloc(row->text, row->len + len + 1);
-    memcpy(&row->text[row->len], s, len);
-    row->len += len;
-    row->text[row->len] = '\0';
+    if (!config.softWrap)
+        return document.rowOffset;
 
-    editorUpdateRow(row);
-    document.dirty++;
+    return prefixSumQuery(editorWrapIndex(), document.rowOffset) + document.wrapOffset;
 }
 
-static void editorUpdateRow(TextRow *row)
+/*
+* Rewrap a chunk of rows whose wrap count is stale after a resize. The visible
+* rows are rewrapped when drawn, this catches up with the others while idle.
+*/
+static void editorRewrapChunk()
 {
-    int tabs = 0;
-    for (int i = 0; i < row->len; i++)
-        if (row->text[i] == '\t')
-            tabs++;
+    int end = document.rewrapNext + REWRAP_CHUNK_ROWS;
 
-    free(row->render);
-    //TAB_STOP - 1 because \t already counts for 1
-    row->render = malloc(row->len + 1 + tabs * (TAB_STOP - 1));
+    if (end > document.rowsCount)
+        end = document.rowsCount;
+
+    for (int i = document.rewrapNext; i < end; i++)
+        editorRowWrapCount(i);
+
+    document.rewrapNext = end == document.rowsCount ? -1 : end;
+}
+
+/*
+* In soft wrap mode the viewport starts at screen line wrapOffset of row
+* rowOffset. When the cursor goes below the screen, the wrap index maps the
+* new top screen line back to a row in O(log n).
+*/
+static void editorScrollWrapped()
+{
+    int segment = 0;
+    int segmentCol = 0;
+
+    document.colOffset = 0;
+
+    if (config.cursorY < document.rowsCount)
+    {
+        segment = editorWrapSegment(&document.rows[config.cursorY], config.cursorRenderX);
+
+        if (segment >= editorRowWrapCount(config.cursorY))
+            segment = editorRowWrapCount(config.cursorY) - 1;
+
+        segmentCol = editorWrapSegmentCol(&document.rows[config.cursorY], segment);
+    }
+
+    if (config.cursorY < document.rowOffset ||
+        (config.cursorY == document.rowOffset && segment < document.wrapOffset))
+    {
+        document.rowOffset = config.cursorY;
+        document.wrapOffset = segment;
+    }
+
+    // the rows which may end up on screen above the cursor must have an exact count
+    for (int i = config.cursorY - 1; i >= 0 && i >= config.cursorY - config.screenRows; i--)
+        editorRowWrapCount(i);
+
+    PrefixSum *index = editorWrapIndex();
+    long cursorLine = prefixSumQuery(index, config.cursorY) + segment;
+    long topLine = prefixSumQuery(index, document.rowOffset) + document.wrapOffset;
+
+    if (cursorLine >= topLine + config.screenRows)
+    {
+        topLine = cursorLine - config.screenRows + 1;
+        document.rowOffset = prefixSumSearch(index, topLine);
+        document.wrapOffset = topLine - prefixSumQuery(index, document.rowOffset);
+    }
+
+    config.cursorScreenRow = cursorLine - topLine;
+    config.cursorScreenCol = config.cursorRenderX - segmentCol;
+
+    if (config.cursorScreenCol >= config.screenCols)
+        config.cursorScreenCol = config.screenCols - 1;
+}
+
+static void editorScroll()
+{
+    config.cursorRenderX = 0;
+
+    if (config.cursorY < document.rowsCount)
+        config.cursorRenderX = editorCursorXToCursorRenderX(
+            &document.rows[config.cursorY], config.cursorX);
+
+    if (config.softWrap)
+    {
+        editorScrollWrapped();
+        return;
+    }
+
+    if (config.cursorRenderX < document.colOffset)
+        document.colOffset = config.cursorRenderX;
+
+    if (config.cursorRenderX >= document.colOffset + config.screenCols)
+        document.colOffset = config.cursorRenderX - config.screenCols + 1;
+
+    if (config.cursorY < document.rowOffset)
+        document.rowOffset = config.cursorY;
+
+    if (config.cursorY >= document.rowOffset + config.screenRows)
+        document.rowOffset = config.cursorY - config.screenRows + 1;
+
+    config.cursorScreenRow = config.cursorY - document.rowOffset;
+    config.cursorScreenCol = config.cursorRenderX - document.colOffset;
+}
+
+// index of the last stop starting before cursorX, -1 if none
+static int editorFindStopByCursorX(const TextRow *row, int cursorX)
+{
+    int low = 0;
+    int high = row->stopsCount;
+
+    while (low < high)
+    {
+        int mid = low + (high - low) / 2;
+
+        if (row->stops[mid].at < cursorX)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return low - 1;
+}
+
+// index of the last stop starting at or before cursorRenderX, -1 if none
+static int editorFindStopByCursorRenderX(const TextRow *row, int cursorRenderX)
+{
+    int low = 0;
+    int high = row->stopsCount;
+
+    while (low < high)
+    {
+        int mid = low + (high - low) / 2;
+
+        if (row->stops[mid].col <= cursorRenderX)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return low - 1;
+}
+
+static int editorCursorXToCursorRenderX(const TextRow *row, int cursorX)
+{
+    int i = editorFindStopByCursorX(row, cursorX);
+
+    if (i == -1)
+        return cursorX;
+
+    const RowStop *stop = &row->stops[i];
+
+    if (cursorX < stop->nextAt)
+        return stop->col;
+
+    return stop->nextCol + (cursorX - stop->nextAt);
+}
+
+static int editorCursorRenderXToCursorX(const TextRow *row, int cursorRenderX)
+{
+    int i = editorFindStopByCursorRenderX(row, cursorRenderX);
+    int cursorX = cursorRenderX;
+
+    if (i != -1)
+    {
+        const RowStop *stop = &row->stops[i];
+
+        if (cursorRenderX < stop->nextCol)
+            return stop->at;
+
+        cursorX = stop->nextAt + (cursorRenderX - stop->nextCol);
+    }
+
+    return cursorX < row->len ? cursorX : row->len;
+}
+
+static void editorRefreshScreen()
+{
+    // keys read in a prompt are processed by the time it redraws
+    latencyKeysProcessed(&config.latency, monotonicMs());
+
+    editorScroll();
+
+    // the terminal is behind : the latest state is drawn once it caught up
+    if (!editorFrameDone())
+    {
+        config.redrawPending = 1;
+        return;
+    }
+
+    config.redrawPending = 0;
+
+    StringBuffer *sb = &config.frame;
+    sbReset(sb);
+
+    screenClear(&config.screen);
+    editorDrawRows(&config.screen);
+    editorDrawStatusBar(&config.screen);
+    editorDrawMessageBar(&config.screen);
+
+    if (config.latencyOverlay)
+        editorDrawLatencyOverlay(&config.screen);
+
+    // the terminal holds the frame until it is complete with synchronized
+    // output, and the cursor is hidden while it jumps between the changes
+    if (config.synchronizedOutput)
+        sbAppend(sb, "\x1b[?2026h", 8);
+
+    sbAppend(sb, "\x1b[?25l", 6);
+
+    // a pure vertical scroll is done by the terminal within the text area,
+    // leaving only the newly exposed rows to draw
+    long topLine = editorTopLine();
+
+    if (document.colOffset == config.drawnColOffset)
+        screenScroll(&config.screen, sb, 0, config.screenRows - 1, topLine - config.drawnTopLine);
+
+    config.drawnTopLine = topLine;
+    config.drawnColOffset = document.colOffset;
+
+    screenRender(&config.screen, sb, config.cursorScreenRow, config.cursorScreenCol);
+
+    sbAppend(sb, "\x1b[?25h", 6);
+
+    if (config.synchronizedOutput)
+        sbAppend(sb, "\x1b[?2026l", 8);
+
+    latencyFrameComposed(&config.latency);
+
+    // the writer thread was idle, it takes the frame
+    outputSubmit(&config.output, sb);
+    config.frameInFlight = 1;
+}
+
+// p50/p99/max of each latency phase in the top right corner of the text area
+static void editorDrawLatencyOverlay(Screen *screen)
+{
+    for (int i = 0; i < LATENCY_PHASES && i < config.screenRows; i++)
+    {
+        const LatencyHistogram *histogram = &config.latency.phases[i];
+        char line[80];
+        int len = snprintf(line, sizeof(line), " %-7s p50 %6.2f p99 %6.2f max %7.2f ms ",
+                           LATENCY_PHASE_NAMES[i],
+                           latencyPercentile(histogram, 50),
+                           latencyPercentile(histogram, 99),
+                           histogram->maxMs);
+
+        if (len > config.screenCols)
+            len = config.screenCols;
+
+        screenPut(screen, i, config.screenCols - len, line, len, SCREEN_ATTR_REVERSE);
+    }
+}
+
+static void editorReportLatency()
+{
+    if (!config.latencyReport)
+        return;
+
+    fprintf(stderr, "latency (ms)      p50      p99      max     keys\n");
+
+    for (int i = 0; i < LATENCY_PHASES; i++)
+    {
+        const LatencyHistogram *histogram = &config.latency.phases[i];
+
+        fprintf(stderr, "%-12s %8.3f %8.3f %8.3f %8lu\n",
+                LATENCY_PHASE_NAMES[i],
+                latencyPercentile(histogram, 50),
+                latencyPercentile(histogram, 99),
+                histogram->maxMs,
+                histogram->count);
+    }
+}
+
+static void editorInsertCharAtRow(const char c, int at, TextRow *row)
+{
+    if (at < 0 || at > row->len)
+        at = row->len;
+
+    row->text = realloc(row->text, row->len + 2);
+    memmove(&row->text[at + 1], &row->text[at], row->len - at + 1);
+    row->len++;
+    row->text[at] = c;
+
+    editorUpdateRow(row);
+    document.dirty++;
+    document.version++;
+}
+
+static void editorDelCharAtRow(const int at, TextRow *row)
+{
+    if (at < 0 || at >= row->len)
+        return;
+
+    // the whole UTF-8 sequence goes
+    unsigned int codepoint;
+    int len = utf8Decode(&row->text[at], row->len - at, &codepoint);
+
+    memmove(&row->text[at], &row->text[at + len], row->len - at - len + 1);
+    row->len -= len;
+
+    editorUpdateRow(row);
+    document.dirty++;
+    document.version++;
+}
+
+static void editorDelChar()
+{
+    if (config.cursorY == document.rowsCount)
+        return;
+
+    if (config.cursorX == 0 && config.cursorY == 0)
+        return;
+
+    TextRow *row = &document.rows[config.cursorY];
+
+    if (config.cursorX > 0)
+    {
+        config.cursorX = editorPreviousCharX(row, config.cursorX);
+        editorDelCharAtRow(config.cursorX, row);
+    }
+    else
+    {
+        config.cursorX = document.rows[config.cursorY - 1].len;
+        editorAppendStringToRow(row->text, row->len, &document.rows[config.cursorY - 1]);
+        editorDelRow(config.cursorY);
+        config.cursorY--;
+    }
+}
+
+static void editorFreeRow(TextRow *row)
+{
+    free(row->stops);
+    free(row->render);
+    free(row->text);
+}
+
+static void editorDelRow(const int at)
+{
+    if (at < 0 || at > document.rowsCount)
+        return;
+
+    editorFreeRow(&document.rows[at]);
+    memmove(&document.rows[at],
+            &document.rows[at + 1],
+            sizeof(TextRow) * (document.rowsCount - at + 1));
+
+    document.rowsCount--;
+    document.dirty++;
+    document.version++;
+    document.wrapIndexValid = 0;
+}
+
+static void editorAppendStringToRow(const char *s, const size_t len, TextRow *row)
+{
+    row->text = realloc(row->text, row->len + len + 1);
+    memcpy(&row->text[row->len], s, len);
+    row->len += len;
+    row->text[row->len] = '\0';
+
+    editorUpdateRow(row);
+    document.dirty++;
+    document.version++;
+}
+
+// a row of ASCII text only needs stops for its tabs
+static void editorUpdateAsciiRow(TextRow *row)
+{
+    int tabs = 0;
+    for (int i = 0; i < row->len; i++)
+        if (row->text[i] == '\t')
+            tabs++;
+
+    //TAB_STOP - 1 because \t already counts for 1
+    row->render = malloc(row->len + 1 + tabs * (TAB_STOP - 1));
+    row->stops = tabs ? malloc(sizeof(RowStop) * tabs) : NULL;
 
     int pos = 0;
 
-    for (int i = 0; i < row->len; i++)
+    for (int i = 0; i < row->len; i++)
+    {
+        if (row->text[i] == '\t')
+        {
+            RowStop *stop = &row->stops[row->stopsCount++];
+            stop->at = i;
+            stop->col = pos;
+            stop->renderAt = pos;
+
+            row->render[pos++] = ' ';
+
+            while (pos % TAB_STOP != 0)
+                row->render[pos++] = ' ';
+
+            stop->nextAt = i + 1;
+            stop->nextCol = pos;
+            stop->nextRenderAt = pos;
+        }
+        else
+        {
+            row->render[pos++] = row->text[i];
+        }
+    }
+
+    row->render[pos] = '\0';
+    row->renderLen = pos;
+    row->renderCols = pos;
+}
+
+// decode the row to find the width of its chars, the column mapping is kept in stops
+static void editorUpdateUtf8Row(TextRow *row)
+{
+    int tabs = 0;
+    int stops = 0;
+
+    for (int i = 0; i < row->len;)
+    {
+        unsigned int codepoint;
+        int len = utf8Decode(&row->text[i], row->len - i, &codepoint);
+
+        if (codepoint == '\t')
+            tabs++;
+
+        if (codepoint == '\t' || len != 1 || utf8Width(codepoint) != 1)
+            stops++;
+
+        i += len;
+    }
+
+    //TAB_STOP - 1 because \t already counts for 1
+    row->render = malloc(row->len + 1 + tabs * (TAB_STOP - 1));
+    row->stops = malloc(sizeof(RowStop) * stops);
+
+    int pos = 0;
+    int col = 0;
+
+    for (int i = 0; i < row->len;)
+    {
+        unsigned int codepoint;
+        int len = utf8Decode(&row->text[i], row->len - i, &codepoint);
+        int width = codepoint == '\t' ? TAB_STOP - col % TAB_STOP : utf8Width(codepoint);
+
+        if (codepoint == '\t' || len != 1 || width != 1)
+        {
+            RowStop *stop = &row->stops[row->stopsCount++];
+            stop->at = i;
+            stop->col = col;
+            stop->renderAt = pos;
+            stop->nextAt = i + len;
+            stop->nextCol = col + width;
+            stop->nextRenderAt = pos + (codepoint == '\t' ? width : len);
+        }
+
+        if (codepoint == '\t')
+        {
+            memset(&row->render[pos], ' ', width);
+            pos += width;
+        }
+        else
+        {
+            memcpy(&row->render[pos], &row->text[i], len);
+            pos += len;
+        }
+
+        col += width;
+        i += len;
+    }
+
+    row->render[pos] = '\0';
+    row->renderLen = pos;
+    row->renderCols = col;
+}
+
+static void editorUpdateRow(TextRow *row)
+{
+    // the row text changed, it no longer matches the file on disk
+    // and its wrap count must be computed again
+    row->diskOffset = -1;
+    row->wrapWidth = 0;
+
+    free(row->render);
+    free(row->stops);
+    row->stops = NULL;
+    row->stopsCount = 0;
+
+    if (utf8IsAscii(row->text, row->len))
+        editorUpdateAsciiRow(row);
+    else
+        editorUpdateUtf8Row(row);
+}
+
+/*
+* Insert a block of text at the cursor in a single pass : the rows array is
+* grown and shifted once, then every row is built and rendered once. Lines
+* end with \n, \r\n or \r since terminals paste newlines as \r.
+*/
+static void editorInsertText(const char *s, size_t len)
+{
+    if (len == 0)
+        return;
+
+    if (config.cursorY == document.rowsCount)
+        editorInsertRow(document.rowsCount, "", 0);
+
+    int newRows = 0;
+
+    for (size_t i = 0; i < len; i++)
+        if (s[i] == '\n' || (s[i] == '\r' && (i + 1 == len || s[i + 1] != '\n')))
+            newRows++;
+
+    if (newRows)
     {
-        if (row->text[i] == '\t')
-        {
-            row->render[pos++] = ' ';
+        document.rows = realloc(document.rows, sizeof(TextRow) * (document.rowsCount + newRows));
+        memmove(&document.rows[config.cursorY + 1 + newRows],
+                &document.rows[config.cursorY + 1],
+                sizeof(TextRow) * (document.rowsCount - config.cursorY - 1));
 
-            while (pos % TAB_STOP != 0)
-                row->render[pos++] = ' ';
+        document.rowsCount += newRows;
+        document.wrapIndexValid = 0;
+    }
+
+    // the text after the cursor ends up after the last inserted line
+    TextRow *row = &document.rows[config.cursorY];
+    size_t tailLen = row->len - config.cursorX;
+    char *tail = malloc(tailLen + 1);
+    memcpy(tail, &row->text[config.cursorX], tailLen);
+
+    const char *line = s;
+    const char *const END = s + len;
+    int at = config.cursorY;
+
+    while (1)
+    {
+        const char *eol = line;
+
+        while (eol < END && *eol != '\n' && *eol != '\r')
+            eol++;
+
+        size_t lineLen = eol - line;
+        size_t prefixLen = at == config.cursorY ? (size_t)config.cursorX : 0;
+        size_t suffixLen = eol == END ? tailLen : 0;
+        char *text = at == config.cursorY ? row->text : NULL;
+
+        text = realloc(text, prefixLen + lineLen + suffixLen + 1);
+        memcpy(&text[prefixLen], line, lineLen);
+        memcpy(&text[prefixLen + lineLen], tail, suffixLen);
+        text[prefixLen + lineLen + suffixLen] = '\0';
+
+        if (at == config.cursorY)
+        {
+            row->text = text;
+            row->len = prefixLen + lineLen + suffixLen;
+            editorUpdateRow(row);
         }
         else
         {
-            row->render[pos++] = row->text[i];
+            editorInitRow(&document.rows[at], text, prefixLen + lineLen + suffixLen);
+        }
+
+        if (eol == END)
+        {
+            config.cursorX = prefixLen + lineLen;
+            break;
         }
+
+        if (eol[0] == '\r' && eol + 1 < END && eol[1] == '\n')
+            eol++;
+
+        line = eol + 1;
+        at++;
     }
 
-    row->render[pos] = '\0';
-    row->renderLen = pos;
+    free(tail);
+    config.cursorY = at;
+    document.dirty++;
+    document.version++;
 }
 
 static void editorInsertNewLine()
@@ -522,6 +1318,22 @@ static void editorInsertNewLine()
     config.cursorY++;
 }
 
+// set up a new row owning text, len bytes long and NUL terminated
+static void editorInitRow(TextRow *row, char *text, size_t len)
+{
+    row->len = len;
+    row->text = text;
+
+    row->renderLen = 0;
+    row->renderCols = 0;
+    row->render = NULL;
+    row->stopsCount = 0;
+    row->stops = NULL;
+    row->wrapCount = 1;
+    row->wrapWidth = 0;
+    editorUpdateRow(row);
+}
+
 static void editorInsertRow(const int at, const char *s, size_t len)
 {
     if (at < 0 || at > document.rowsCount)
@@ -530,146 +1342,565 @@ static void editorInsertRow(const int at, const char *s, size_t len)
     document.rows = realloc(document.rows, sizeof(TextRow) * (document.rowsCount + 1));
     memmove(&document.rows[at + 1], &document.rows[at], sizeof(TextRow) * (document.rowsCount - at));
 
-    document.rows[at].len = len;
-    document.rows[at].text = malloc(len + 1);
-    memcpy(document.rows[at].text, s, len);
-    document.rows[at].text[len] = '\0';
+    char *text = malloc(len + 1);
+    memcpy(text, s, len);
+    text[len] = '\0';
+    editorInitRow(&document.rows[at], text, len);
+
+    document.rowsCount++;
+    document.dirty++;
+    document.version++;
+    document.wrapIndexValid = 0;
+}
+
+/*
+* Write every row to fd. Runs of rows still matching the file on disk are
+* copied from diskFd with copyFileRange, so only the modified rows go
+* through user space. Returns the number of bytes written or -1.
+*/
+static off_t editorWriteRows(const int fd, const int diskFd, double *serializeMs, double *writeMs, off_t *copied)
+{
+    StringBuffer sb = SB_INIT;
+    double serializeStart = 0;
+    off_t total = 0;
+    int i = 0;
+
+    while (i < document.rowsCount)
+    {
+        const TextRow *row = &document.rows[i];
+
+        if (diskFd != -1 && row->diskOffset != -1)
+        {
+            off_t runLen = row->len + 1;
+
+            for (i++; i < document.rowsCount; i++)
+            {
+                if (document.rows[i].diskOffset != row->diskOffset + runLen)
+                    break;
+
+                runLen += document.rows[i].len + 1;
+            }
+
+            double start = monotonicMs();
+
+            if (sb.len > 0)
+                *serializeMs += start - serializeStart;
+
+            if (writeAll(fd, sb.s, sb.len) == -1 ||
+                copyFileRange(diskFd, row->diskOffset, fd, runLen) == -1)
+            {
+                sbFree(&sb);
+                return -1;
+            }
+
+            *writeMs += monotonicMs() - start;
+            total += sb.len + runLen;
+            *copied += runLen;
+            sbReset(&sb);
+
+            continue;
+        }
+
+        // serialization is timed per chunk, a clock read per row costs more than the copy
+        if (sb.len == 0)
+            serializeStart = monotonicMs();
+
+        sbAppend(&sb, row->text, row->len);
+        sbAppend(&sb, "\n", 1);
+        i++;
+
+        if (sb.len >= SAVE_CHUNK_SIZE || i == document.rowsCount)
+        {
+            double start = monotonicMs();
+            *serializeMs += start - serializeStart;
+
+            if (writeAll(fd, sb.s, sb.len) == -1)
+            {
+                sbFree(&sb);
+                return -1;
+            }
+
+            *writeMs += monotonicMs() - start;
+            total += sb.len;
+            sbReset(&sb);
+        }
+    }
+
+    sbFree(&sb);
+
+    return total;
+}
+
+/*
+* Flush the saved file according to the configured durability :
+* DURABILITY_NONE leaves it to the page cache, DURABILITY_DATA flushes the
+* file content and DURABILITY_FULL also flushes its metadata.
+*/
+static int editorSyncFile(const int fd)
+{
+    switch (config.durability)
+    {
+    case DURABILITY_NONE:
+        return 0;
+    case DURABILITY_DATA:
+        return fdatasync(fd);
+    case DURABILITY_FULL:
+        break;
+    }
+
+    return fsync(fd);
+}
+
+/*
+* With DURABILITY_FULL, flush the parent directory as well so that the
+* rename of the saved file survives a crash.
+*/
+static int editorSyncDirectory()
+{
+    if (config.durability != DURABILITY_FULL)
+        return 0;
+
+    char *path = strdup(document.filename);
+    int dirFd = open(dirname(path), O_RDONLY | O_DIRECTORY);
+    free(path);
+
+    if (dirFd == -1)
+        return -1;
+
+    int result = fsync(dirFd);
+    close(dirFd);
+
+    return result;
+}
+
+/*
+* Open the file on disk for reading if it is still the one the rows
+* diskOffset were computed against, -1 otherwise.
+*/
+static int editorOpenDiskFile()
+{
+    if (!document.hasDiskStat)
+        return -1;
+
+    int fd = open(document.filename, O_RDONLY);
+    struct stat st;
+
+    if (fd == -1)
+        return -1;
+
+    if (fstat(fd, &st) == -1 ||
+        st.st_dev != document.diskStat.st_dev ||
+        st.st_ino != document.diskStat.st_ino ||
+        st.st_size != document.diskStat.st_size ||
+        st.st_mtim.tv_sec != document.diskStat.st_mtim.tv_sec ||
+        st.st_mtim.tv_nsec != document.diskStat.st_mtim.tv_nsec)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/*
+* Create the temporary file a save is written to before being renamed over
+* the target, with the owner, mode and attributes of the target when it
+* exists. Returns its fd, or -1 with tmpPath freed and set to NULL.
+*/
+static int editorCreateTempFile(char **tmpPath, const struct stat *st)
+{
+    size_t pathLen = strlen(document.filename);
+    *tmpPath = malloc(pathLen + 8);
+    memcpy(*tmpPath, document.filename, pathLen);
+    memcpy(&(*tmpPath)[pathLen], ".XXXXXX", 8);
+
+    int fd = mkstemp(*tmpPath);
+
+    if (fd != -1)
+    {
+        int result;
+
+        // mkstemp creates the file 0600 and ours
+        if (st != NULL)
+        {
+            result = copyFileAttributes(document.filename, st, fd);
+        }
+        else
+        {
+            mode_t mask = umask(0);
+            umask(mask);
+            result = fchmod(fd, 0644 & ~mask);
+        }
+
+        if (result != -1)
+            return fd;
+
+        close(fd);
+        unlink(*tmpPath);
+    }
+
+    free(*tmpPath);
+    *tmpPath = NULL;
+
+    return -1;
+}
+
+/*
+* The document is written to a temporary file next to the original one which
+* is then renamed over it, so a failed save never leaves a truncated file.
+* The rename would turn a symlink or a hard link into a separate file, so
+* these are rewritten in place, as is a file in a directory the temporary
+* file can't be created in.
+*/
+static void editorSave()
+{
+    static const char *DURABILITY_NAMES[] = {"none", "data", "full"};
+
+    if (document.filename == NULL)
+    {
+        document.filename = editorPrompt("Save as : %s (ESC to cancel)", NULL, 0);
+
+        if (document.filename == NULL)
+        {
+            editorSetStatusMessage("Save aborted!");
+            return;
+        }
+    }
+
+    struct stat st;
+    int exists = lstat(document.filename, &st) != -1;
+    char *tmpPath = NULL;
+    int diskFd = -1;
+    int fd = -1;
+
+    if (!exists || (S_ISREG(st.st_mode) && st.st_nlink == 1))
+        fd = editorCreateTempFile(&tmpPath, exists ? &st : NULL);
+
+    // writing in place truncates the file, so nothing can be copied from it
+    if (fd == -1)
+        fd = open(document.filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    else if (exists)
+        diskFd = editorOpenDiskFile();
+
+    if (fd != -1)
+    {
+        double serializeMs = 0;
+        double writeMs = 0;
+        off_t copied = 0;
+        off_t len = editorWriteRows(fd, diskFd, &serializeMs, &writeMs, &copied);
+
+        if (len != -1)
+        {
+            double start = monotonicMs();
+
+            if (editorSyncFile(fd) != -1 &&
+                (tmpPath == NULL ||
+                 (rename(tmpPath, document.filename) != -1 && editorSyncDirectory() != -1)))
+            {
+                double syncMs = monotonicMs() - start;
+                off_t offset = 0;
+
+                for (int i = 0; i < document.rowsCount; i++)
+                {
+                    document.rows[i].diskOffset = offset;
+                    offset += document.rows[i].len + 1;
+                }
+
+                document.hasDiskStat = fstat(fd, &document.diskStat) != -1;
+
+                close(fd);
+
+                if (diskFd != -1)
+                    close(diskFd);
+
+                free(tmpPath);
+
+                document.dirty = 0;
+                editorSetStatusMessage("%lld bytes [%s, %d%% copied] serialize %.1f write %.1f sync %.1f ms",
+                                       (long long)len, DURABILITY_NAMES[config.durability],
+                                       len ? (int)(copied * 100 / len) : 0,
+                                       serializeMs, writeMs, syncMs);
+
+                return;
+            }
+        }
+
+        int err = errno;
+        close(fd);
+
+        if (tmpPath != NULL)
+            unlink(tmpPath);
+
+        errno = err;
+    }
+
+    if (diskFd != -1)
+        close(diskFd);
+
+    free(tmpPath);
+    editorSetStatusMessage("File NOT save! I/O error: %s", strerror(errno));
+}
+
+static void editorOpen(const char *filename)
+{
+    free(document.filename);
+    document.filename = strdup(filename);
+
+    FILE *fp = fopen(filename, "r");
+
+    if (!fp)
+        die("fopen");
+
+    document.hasDiskStat = fstat(fileno(fp), &document.diskStat) != -1;
+
+    char *line = NULL;
+    size_t lineCap = 0;
+    ssize_t len;
+    off_t offset = 0;
+
+    while ((len = getline(&line, &lineCap, fp)) != -1)
+    {
+        ssize_t lineLen = len;
+
+        while (len > 0 && (line[len - 1] == '\r' || line[len - 1] == '\n'))
+            len--;
+
+        editorInsertRow(document.rowsCount, line, len);
+
+        // only rows saved back byte for byte can be copied from the disk
+        if (lineLen == len + 1 && line[len] == '\n')
+            document.rows[document.rowsCount - 1].diskOffset = offset;
+
+        offset += lineLen;
+    }
+
+    free(line);
+    fclose(fp);
+    document.dirty = 0;
+}
+
+// forget the hits cached for every row
+static void editorHighlightInvalidate()
+{
+    for (int i = 0; i < HIGHLIGHT_CACHE_ROWS; i++)
+        config.highlight.rows[i].at = -1;
+}
+
+/*
+* Highlight the hits of query from now on, or nothing if it is NULL, empty
+* or an invalid regex. flags are the ones of the search.
+*/
+static void editorSetHighlight(const char *query, int flags)
+{
+    Highlight *highlight = &config.highlight;
+
+    if (query && highlight->query && strcmp(query, highlight->query) == 0 && flags == highlight->flags)
+        return;
+
+    if (highlight->query && (highlight->flags & SEARCH_REGEX))
+    {
+        regexMatcherFree(&highlight->matcher);
+        regexFree(&highlight->regex);
+    }
+
+    free(highlight->query);
+    highlight->query = query && *query ? strdup(query) : NULL;
+    highlight->queryLen = highlight->query ? strlen(query) : 0;
+    highlight->flags = flags;
+    editorHighlightInvalidate();
+
+    if (!highlight->query || !(flags & SEARCH_REGEX))
+        return;
+
+    if (regexCompile(&highlight->regex, highlight->query, highlight->queryLen, flags & SEARCH_IGNORE_CASE) == -1)
+    {
+        regexFree(&highlight->regex);
+        free(highlight->query);
+        highlight->query = NULL;
+        return;
+    }
+
+    regexMatcherInit(&highlight->matcher, &highlight->regex);
+}
+
+// the next hit of the highlighted query in row from byte from on
+static int editorNextMatch(const TextRow *row, int from, int *start, int *end)
+{
+    Highlight *highlight = &config.highlight;
+
+    if (highlight->flags & SEARCH_REGEX)
+    {
+        size_t matchStart, matchEnd;
+
+        if (!regexSearch(&highlight->matcher, row->text, row->len, from, &matchStart, &matchEnd))
+            return 0;
+
+        *start = matchStart;
+        *end = matchEnd;
+        return 1;
+    }
+
+    const char *match = highlight->flags & SEARCH_IGNORE_CASE
+                            ? searchFindIgnoreCase(row->text + from, row->len - from, highlight->query, highlight->queryLen)
+                            : searchFind(row->text + from, row->len - from, highlight->query, highlight->queryLen);
+
+    if (!match)
+        return 0;
+
+    *start = match - row->text;
+    *end = *start + highlight->queryLen;
+    return 1;
+}
+
+static const HighlightRow *editorRowMatches(int at)
+{
+    Highlight *highlight = &config.highlight;
+
+    if (highlight->version != document.version)
+    {
+        highlight->version = document.version;
+        editorHighlightInvalidate();
+    }
+
+    HighlightRow *cached = &highlight->rows[at % HIGHLIGHT_CACHE_ROWS];
+
+    if (cached->at == at)
+        return cached;
+
+    const TextRow *row = &document.rows[at];
+    int start, end;
+
+    cached->at = at;
+    cached->count = 0;
 
-    document.rows[at].renderLen = 0;
-    document.rows[at].render = NULL;
-    editorUpdateRow(&document.rows[at]);
+    for (int x = 0; x <= (int)row->len && editorNextMatch(row, x, &start, &end); x = end)
+    {
+        // an empty regex match shows nothing, the next one starts a char later
+        if (start == end)
+        {
+            end = start < (int)row->len ? editorNextCharX(row, start) : start + 1;
+            continue;
+        }
+
+        if (cached->count == cached->size)
+        {
+            cached->size = cached->size ? cached->size * 2 : 8;
+            cached->spans = realloc(cached->spans, cached->size * sizeof(MatchSpan));
+        }
+
+        cached->spans[cached->count].col = editorCursorXToCursorRenderX(row, start);
+        cached->spans[cached->count].endCol = editorCursorXToCursorRenderX(row, end);
+        cached->count++;
+    }
 
-    document.rowsCount++;
-    document.dirty++;
+    return cached;
 }
 
-// caller is responsible for freeing the returned buffer
-static char *editorRowsToString(int *bufferLen)
+// highlight the hits of row at drawn from render column fromCol
+static void editorDrawMatches(Screen *screen, int screenRow, int at, int fromCol, int toCol)
 {
-    int totLen = 0;
-
-    for (int i = 0; i < document.rowsCount; i++)
-        totLen += document.rows[i].len + 1;
-
-    *bufferLen = totLen;
+    if (!config.highlight.query)
+        return;
 
-    char *buffer = malloc(totLen);
-    char *endLine = buffer;
+    const HighlightRow *matches = editorRowMatches(at);
 
-    for (int i = 0; i < document.rowsCount; i++)
+    for (int i = 0; i < matches->count; i++)
     {
-        memcpy(endLine, document.rows[i].text, document.rows[i].len);
-        endLine += document.rows[i].len;
-        *endLine = '\n';
-        endLine++;
-    }
+        int col = matches->spans[i].col > fromCol ? matches->spans[i].col : fromCol;
+        int endCol = matches->spans[i].endCol < toCol ? matches->spans[i].endCol : toCol;
 
-    return buffer;
+        if (endCol > col)
+            screenAddAttr(screen, screenRow, col - fromCol, endCol - col, SCREEN_ATTR_MATCH);
+    }
 }
 
 /*
-* Improve by saving to a temporary file and renaming it 
-* if the whole process succeeded without error
+* Draw the render of a row from column fromCol on, at the start of the
+* given screen row. A wide char cut by the left edge is replaced by spaces.
 */
-static void editorSave()
+static void editorDrawRender(Screen *screen, int screenRow, const TextRow *row, int fromCol)
 {
-    if (document.filename == NULL)
+    int i = editorFindStopByCursorRenderX(row, fromCol);
+    int at = fromCol;
+    int col = 0;
+
+    if (i != -1)
     {
-        document.filename = editorPrompt("Save as : %s (ESC to cancel)", NULL);
+        const RowStop *stop = &row->stops[i];
 
-        if (document.filename == NULL)
+        if (fromCol >= stop->nextCol)
         {
-            editorSetStatusMessage("Save aborted!");
-            return;
+            at = stop->nextRenderAt + (fromCol - stop->nextCol);
         }
-    }
-
-    int len;
-    char *buffer = editorRowsToString(&len);
-
-    int fd = open(document.filename, O_RDWR | O_CREAT, 0644);
-
-    if (fd != -1)
-    {
-        if (ftruncate(fd, len) != -1)
+        else if (fromCol == stop->col || row->text[stop->at] == '\t')
         {
-            if (write(fd, buffer, len) == len)
-            {
-                close(fd);
-                free(buffer);
-
-                document.dirty = 0;
-                editorSetStatusMessage("%d bytes written to disk", len);
-
-                return;
-            }
+            at = stop->renderAt + (fromCol - stop->col);
+        }
+        else
+        {
+            col = stop->nextCol - fromCol;
+            screenFill(screen, screenRow, 0, ' ', col, SCREEN_ATTR_NORMAL);
+            at = stop->nextRenderAt;
         }
-
-        close(fd);
     }
 
-    free(buffer);
-    editorSetStatusMessage("File NOT save! I/O error: %s", strerror(errno));
+    if (at < row->renderLen)
+        screenPut(screen, screenRow, col, &row->render[at], row->renderLen - at, SCREEN_ATTR_NORMAL);
 }
 
-static void editorOpen(const char *filename)
+static void editorDrawRowsWrapped(Screen *screen)
 {
-    free(document.filename);
-    document.filename = strdup(filename);
+    int documentRow = document.rowOffset;
+    int segment = document.wrapOffset;
+    int fromCol = documentRow < document.rowsCount ? editorWrapSegmentCol(&document.rows[documentRow], segment) : 0;
 
-    FILE *fp = fopen(filename, "r");
+    for (int i = 0; i < config.screenRows; i++)
+    {
+        if (documentRow >= document.rowsCount)
+        {
+            screenPut(screen, i, 0, EDITOR_ROW_DECORATOR, EDITOR_ROW_DECORATOR_LEN, SCREEN_ATTR_NORMAL);
+            continue;
+        }
 
-    if (!fp)
-        die("fopen");
+        const TextRow *row = &document.rows[documentRow];
+        int toCol = editorNextWrapCol(row, fromCol);
 
-    char *line = NULL;
-    size_t lineCap = 0;
-    ssize_t len;
+        editorDrawRender(screen, i, row, fromCol);
+        editorDrawMatches(screen, i, documentRow, fromCol, toCol);
 
-    while ((len = getline(&line, &lineCap, fp)) != -1)
-    {
-        while (len > 0 && (line[len - 1] == '\r' || line[len - 1] == '\n'))
-            len--;
+        fromCol = toCol;
 
-        editorInsertRow(document.rowsCount, line, len);
+        if (++segment >= editorRowWrapCount(documentRow))
+        {
+            documentRow++;
+            segment = 0;
+            fromCol = 0;
+        }
     }
-
-    free(line);
-    fclose(fp);
-    document.dirty = 0;
 }
 
-static void editorDrawRows(StringBuffer *sb)
+static void editorDrawRows(Screen *screen)
 {
-    for (int i = 0; i < config.screenRows; i++)
+    if (config.softWrap)
+        editorDrawRowsWrapped(screen);
+
+    for (int i = 0; i < config.screenRows && !config.softWrap; i++)
     {
         int documentRow = document.rowOffset + i;
 
         if (documentRow >= document.rowsCount)
         {
-            if (document.rowsCount == 0 && i == config.screenRows / 3)
-                editorDrawWelcome(sb);
-            else
-                sbAppend(sb, EDITOR_ROW_DECORATOR, EDITOR_ROW_DECORATOR_LEN);
+            screenPut(screen, i, 0, EDITOR_ROW_DECORATOR, EDITOR_ROW_DECORATOR_LEN, SCREEN_ATTR_NORMAL);
         }
         else
         {
-            int len = document.rows[documentRow].renderLen - document.colOffset;
-
-            if (len < 0)
-                len = 0;
-
-            if (len >= config.screenCols)
-                len = config.screenCols;
-
-            sbAppend(sb, &document.rows[documentRow].render[document.colOffset], len);
+            editorDrawRender(screen, i, &document.rows[documentRow], document.colOffset);
+            editorDrawMatches(screen, i, documentRow, document.colOffset, document.colOffset + config.screenCols);
         }
-
-        // erase all char from active position to the end of the screen
-        sbAppend(sb, "\x1b[K", 3);
-
-        sbAppend(sb, "\r\n", 2);
     }
+
+    if (document.rowsCount == 0)
+        editorDrawWelcome(screen, config.screenRows / 3);
 }
 
 static void editorInsertChar(const char c)
@@ -681,16 +1912,42 @@ static void editorInsertChar(const char c)
     config.cursorX++;
 }
 
+// start of the char before cursorX
+static int editorPreviousCharX(const TextRow *row, int cursorX)
+{
+    if (cursorX > 0)
+        cursorX--;
+
+    while (cursorX > 0 && UTF8_IS_CONTINUATION(row->text[cursorX]))
+        cursorX--;
+
+    return cursorX;
+}
+
+// start of the char after cursorX
+static int editorNextCharX(const TextRow *row, int cursorX)
+{
+    if (cursorX < row->len)
+        cursorX++;
+
+    while (cursorX < row->len && UTF8_IS_CONTINUATION(row->text[cursorX]))
+        cursorX++;
+
+    return cursorX;
+}
+
 static void editorMoveCursor(int key)
 {
     TextRow *row = config.cursorY >= document.rowsCount ? NULL : &document.rows[config.cursorY];
+    // going up or down keeps the cursor at the same column on screen
+    int renderX = row ? editorCursorXToCursorRenderX(row, config.cursorX) : 0;
 
     switch (key)
     {
     case ARROW_LEFT:
         if (config.cursorX > 0)
         {
-            config.cursorX--;
+            config.cursorX = editorPreviousCharX(row, config.cursorX);
         }
         else if (config.cursorY > 0)
         {
@@ -701,11 +1958,14 @@ static void editorMoveCursor(int key)
     case ARROW_DOWN:
         if (config.cursorY < document.rowsCount)
             config.cursorY++;
+
+        if (config.cursorY < document.rowsCount)
+            config.cursorX = editorCursorRenderXToCursorX(&document.rows[config.cursorY], renderX);
         break;
     case ARROW_RIGHT:
         if (row && config.cursorX < row->len)
         {
-            config.cursorX++;
+            config.cursorX = editorNextCharX(row, config.cursorX);
         }
         else if (row && config.cursorX == row->len)
         {
@@ -716,10 +1976,17 @@ static void editorMoveCursor(int key)
         break;
     case ARROW_UP:
         if (config.cursorY > 0)
+        {
             config.cursorY--;
+            config.cursorX = editorCursorRenderXToCursorX(&document.rows[config.cursorY], renderX);
+        }
         break;
     case PAGE_UP:
     case PAGE_DOWN:
+        // the keys since the last frame (coalesced, or dropped while the
+        // terminal was behind) may have moved the cursor off rowOffset
+        editorScroll();
+
         if (key == PAGE_UP)
         {
             config.cursorY = document.rowOffset;
@@ -749,6 +2016,25 @@ static void editorMoveCursor(int key)
 
     if (config.cursorX > rowLen)
         config.cursorX = rowLen;
+
+    // never stop in the middle of a UTF-8 sequence
+    while (config.cursorX > 0 && config.cursorX < rowLen && UTF8_IS_CONTINUATION(row->text[config.cursorX]))
+        config.cursorX--;
+}
+
+static void editorToggleSoftWrap()
+{
+    config.softWrap = !config.softWrap;
+    document.wrapOffset = 0;
+
+    // rows edited while soft wrap was off have a stale count, catch up in the background
+    if (config.softWrap)
+        document.rewrapNext = 0;
+
+    // the whole text area changes, there is nothing to scroll
+    config.drawnTopLine = editorTopLine();
+
+    editorSetStatusMessage("Soft wrap %s", config.softWrap ? "on" : "off");
 }
 
 static void editorProcessKeyPress()
@@ -771,11 +2057,24 @@ static void editorProcessKeyPress()
             return;
         }
 
+        outputDrain(&config.output);
         clearScreeen();
         exit(0);
         break;
     case CTRL_KEY('f'):
-        editorFind();
+        editorFind(0);
+        break;
+    case CTRL_KEY('g'):
+        editorFind(SEARCH_REGEX);
+        break;
+    case CTRL_KEY('r'):
+        editorReplace();
+        break;
+    case CTRL_KEY('w'):
+        editorToggleSoftWrap();
+        break;
+    case CTRL_KEY('p'):
+        config.latencyOverlay = !config.latencyOverlay;
         break;
     case BACKSPACE:
     case CTRL_KEY('h'):
@@ -797,8 +2096,18 @@ static void editorProcessKeyPress()
     case END_KEY:
         editorMoveCursor(c);
         break;
-    case CTRL_KEY('l'):
+    case PASTE_START:
+    {
+        StringBuffer paste = SB_INIT;
+        editorReadPaste(&paste);
+        editorInsertText(paste.s, paste.len);
+        sbFree(&paste);
+        break;
+    }
     case ESC_CHAR:
+        editorSetHighlight(NULL, 0);
+        break;
+    case CTRL_KEY('l'):
         break;
     default:
         editorInsertChar(c);
@@ -808,13 +2117,18 @@ static void editorProcessKeyPress()
     quitTimes = QUIT_TIMES;
 }
 
-static char *editorPrompt(const char *prompt, void (*callback)(char *, int))
+/*
+* Read a line in the status bar, NULL if ESC was pressed. Enter accepts an
+* empty line only with allowEmpty.
+*/
+static char *editorPrompt(const char *prompt, void (*callback)(char *, int), int allowEmpty)
 {
     size_t bufferSize = 128;
     char *buffer = malloc(bufferSize);
     buffer[0] = '\0';
 
     size_t bufferLen = 0;
+    config.prompting = 1;
 
     while (1)
     {
@@ -825,6 +2139,7 @@ static char *editorPrompt(const char *prompt, void (*callback)(char *, int))
 
         if (c == ESC_CHAR)
         {
+            config.prompting = 0;
             editorSetStatusMessage("");
 
             if (callback)
@@ -836,13 +2151,19 @@ static char *editorPrompt(const char *prompt, void (*callback)(char *, int))
         }
         else if (c == DEL_KEY || c == CTRL_KEY('h') || c == BACKSPACE)
         {
+            while (bufferLen != 0 && UTF8_IS_CONTINUATION(buffer[bufferLen - 1]))
+                bufferLen--;
+
             if (bufferLen != 0)
-                buffer[--bufferLen] = '\0';
+                bufferLen--;
+
+            buffer[bufferLen] = '\0';
         }
         else if (c == '\r')
         {
-            if (bufferLen != 0)
+            if (bufferLen != 0 || allowEmpty)
             {
+                config.prompting = 0;
                 editorSetStatusMessage("");
 
                 if (callback)
@@ -851,7 +2172,25 @@ static char *editorPrompt(const char *prompt, void (*callback)(char *, int))
                 return buffer;
             }
         }
-        else if (!iscntrl(c) && c < 128)
+        else if (c == PASTE_START)
+        {
+            // the prompt is a single line, only the printable bytes of a paste are kept
+            StringBuffer paste = SB_INIT;
+            editorReadPaste(&paste);
+
+            while (bufferLen + paste.len >= bufferSize)
+                bufferSize *= 2;
+
+            buffer = realloc(buffer, bufferSize);
+
+            for (unsigned i = 0; i < paste.len; i++)
+                if ((unsigned char)paste.s[i] >= 128 || !iscntrl(paste.s[i]))
+                    buffer[bufferLen++] = paste.s[i];
+
+            buffer[bufferLen] = '\0';
+            sbFree(&paste);
+        }
+        else if ((!iscntrl(c) && c < 128) || (c >= 128 && c < 256))
         {
             if (bufferLen == bufferSize - 1)
             {
@@ -868,98 +2207,373 @@ static char *editorPrompt(const char *prompt, void (*callback)(char *, int))
     }
 }
 
-static void editorFindCallBack(char *query, int key)
+static const char *editorSearchRowText(int at, size_t *len)
+{
+    *len = document.rows[at].len;
+    return document.rows[at].text;
+}
+
+/*
+* Move to the first hit of the search once it is known.
+* Returns 0 while it is pending.
+*/
+static int editorFindApplyResult()
+{
+    int row, col;
+    enum SearchStatus status = searchPoolResult(&config.search, &row, &col);
+
+    if (status == SEARCH_PENDING)
+        return 0;
+
+    config.searching = 0;
+
+    if (status == SEARCH_FOUND)
+    {
+        config.findLastMatch = row;
+        config.cursorX = col;
+        config.cursorY = row;
+        document.rowOffset = document.rowsCount;
+    }
+
+    return 1;
+}
+
+static void editorOnSearchDone(int fd)
+{
+    (void)fd;
+    searchPoolAck(&config.search);
+
+    if (config.searching && editorFindApplyResult())
+        editorRefreshScreen();
+}
+
+// the prompt of editorFind, showing the search kind and case mode
+static void editorFindUpdatePrompt()
+{
+    static const char *modes[] = {"match case", "smart case", "ignore case"};
+
+    snprintf(config.findPrompt, sizeof(config.findPrompt), "%s [%s] : %%s (ESC to cancel)",
+             config.replacing ? "Replace" : config.findFlags & SEARCH_REGEX ? "Regex search" : "Search",
+             modes[config.findCase]);
+}
+
+/*
+* The flags to search query with. Smart case ignores the case unless query
+* has an upper case letter, not counting the escapes of a regex such as \W.
+*/
+static int editorFindSearchFlags(const char *query)
 {
-    static int lastMatch = -1;
-    static int direction = 1; //down = 1, up = -1
+    int ignoreCase = config.findCase == FIND_IGNORE_CASE;
 
+    if (config.findCase == FIND_SMART_CASE)
+    {
+        ignoreCase = 1;
+
+        for (const char *c = query; *c; c++)
+        {
+            if ((config.findFlags & SEARCH_REGEX) && *c == '\\' && c[1])
+                c++;
+            else if (*c >= 'A' && *c <= 'Z')
+                ignoreCase = 0;
+        }
+    }
+
+    return config.findFlags | (ignoreCase ? SEARCH_IGNORE_CASE : 0);
+}
+
+/*
+* The rows are searched in the background by the workers of config.search,
+* the prompt keeps reading keys meanwhile and the next one cancels the search.
+* As the query grows, the pool only searches the rows that matched it so far.
+* A regex query that does not compile is not searched nor highlighted.
+* Ctrl+T switches to the next case mode and searches again.
+*/
+static void editorFindCallBack(char *query, int key)
+{
     if (key == '\r' || key == ESC_CHAR)
     {
-        lastMatch = -1;
-        direction = 1;
+        if (config.searching)
+        {
+            // the query is accepted as soon as its hit is known
+            if (key == '\r')
+            {
+                searchPoolWait(&config.search);
+                editorFindApplyResult();
+            }
+            else
+            {
+                searchPoolCancel(&config.search);
+            }
+
+            config.searching = 0;
+        }
+
+        if (key == '\r' && config.findError)
+            editorSetStatusMessage("Invalid regex : %s", config.findError);
+
+        // an accepted query stays highlighted until ESC
+        if (key == ESC_CHAR)
+            editorSetHighlight(NULL, 0);
+
+        config.findLastMatch = -1;
+        config.findDirection = 1;
         return;
     }
     else if (key == ARROW_RIGHT || key == ARROW_DOWN)
     {
-        direction = 1;
+        config.findDirection = 1;
     }
     else if (key == ARROW_LEFT || key == ARROW_UP)
     {
-        direction = -1;
+        config.findDirection = -1;
     }
     else
     {
-        lastMatch = -1;
-        direction = -1;
-    }
+        if (key == CTRL_KEY('t'))
+        {
+            config.findCase = (config.findCase + 1) % 3;
+            editorFindUpdatePrompt();
+        }
 
-    if (lastMatch == -1)
-        direction = 1;
+        config.findLastMatch = -1;
+        config.findDirection = -1;
+    }
 
-    int current = lastMatch;
+    if (config.findLastMatch == -1)
+        config.findDirection = 1;
 
-    for (int i = 0; i < document.rowsCount; i++)
-    {
-        current += direction;
+    int flags = editorFindSearchFlags(query);
 
-        if (current == -1)
-            current = document.rowsCount - 1;
-        else if (current == document.rowsCount)
-            current = 0;
+    editorSetHighlight(query, flags);
 
-        const TextRow *ROW = &document.rows[current];
-        const char *const MATCH = strstr(ROW->text, query);
+    config.findError = NULL;
 
-        if (MATCH)
-        {
-            lastMatch = current;
-            config.cursorX = editorCursorRenderXToCursorX(ROW, MATCH - ROW->render);
-            config.cursorY = current;
-            document.rowOffset = document.rowsCount;
-            break;
-        }
+    if (searchPoolStart(&config.search, editorSearchRowText, document.rowsCount, document.version,
+                        config.findLastMatch + config.findDirection, config.findDirection,
+                        query, strlen(query), flags) == -1)
+    {
+        config.findError = config.search.regex.error;
+        return;
     }
+
+    config.searching = 1;
 }
 
-static void editorFind()
+/*
+* Prompt for a query, moving to its hits as it is typed. Returns the query,
+* or NULL if the prompt was cancelled and the cursor went back.
+* flags are SEARCH_REGEX for a regex search, 0 for a plain one.
+*/
+static char *editorFindPrompt(int flags)
 {
     int oldCx = config.cursorX;
     int oldCy = config.cursorY;
     int oldRowOffset = document.rowOffset;
     int oldColOffset = document.colOffset;
 
-    char *query = editorPrompt("Search : %s (ESC to cancel)", editorFindCallBack);
+    config.findFlags = flags;
+    config.findError = NULL;
+    editorFindUpdatePrompt();
 
-    if (query)
-    {
-        free(query);
-    }
-    else
+    // the prompt is read again after each key, Ctrl+T updates it
+    char *query = editorPrompt(config.findPrompt, editorFindCallBack, 0);
+
+    if (!query)
     {
         config.cursorX = oldCx;
         config.cursorY = oldCy;
         document.rowOffset = oldRowOffset;
         document.colOffset = oldColOffset;
     }
+
+    return query;
+}
+
+static void editorFind(int flags)
+{
+    free(editorFindPrompt(flags));
+}
+
+/*
+* Replace the hits of query in row by replacement, the row is rebuilt once
+* with its final length. matches is scratch for the hit offsets.
+* Returns the number of hits.
+*/
+static int editorReplaceInRow(TextRow *row, const char *query, size_t queryLen, int flags,
+                              const char *replacement, size_t replacementLen, int **matches, int *matchesSize)
+{
+    int count = 0;
+    const char *match = row->text;
+
+    while ((match = flags & SEARCH_IGNORE_CASE ? searchFindIgnoreCase(match, row->text + row->len - match, query, queryLen)
+                                               : searchFind(match, row->text + row->len - match, query, queryLen)))
+    {
+        if (count == *matchesSize)
+        {
+            *matchesSize = *matchesSize ? *matchesSize * 2 : 64;
+            *matches = realloc(*matches, *matchesSize * sizeof(int));
+        }
+
+        (*matches)[count++] = match - row->text;
+        match += queryLen;
+    }
+
+    if (count == 0)
+        return 0;
+
+    int len = row->len + count * ((int)replacementLen - (int)queryLen);
+    char *text = malloc(len + 1);
+    int from = 0;
+    int at = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        memcpy(&text[at], &row->text[from], (*matches)[i] - from);
+        at += (*matches)[i] - from;
+        memcpy(&text[at], replacement, replacementLen);
+        at += replacementLen;
+        from = (*matches)[i] + queryLen;
+    }
+
+    memcpy(&text[at], &row->text[from], row->len - from);
+    text[len] = '\0';
+
+    free(row->text);
+    row->text = text;
+    row->len = len;
+    editorUpdateRow(row);
+
+    return count;
+}
+
+/*
+* Replace all the hits of a query, searched as with Ctrl+F and its case mode.
+* Each row with hits is rebuilt once and the document marked dirty once, so
+* millions of hits cost a single pass over the rows. There is no undo.
+*/
+static void editorReplace()
+{
+    config.replacing = 1;
+    char *query = editorFindPrompt(0);
+    config.replacing = 0;
+
+    if (!query)
+        return;
+
+    int flags = editorFindSearchFlags(query);
+    char *replacement = editorPrompt("Replace with : %s (ESC to cancel)", NULL, 1);
+
+    if (!replacement)
+    {
+        editorSetHighlight(NULL, 0);
+        free(query);
+        return;
+    }
+
+    // the workers must not read the rows while they change
+    searchPoolCancel(&config.search);
+
+    size_t queryLen = strlen(query);
+    size_t replacementLen = strlen(replacement);
+    int *matches = NULL;
+    int matchesSize = 0;
+    long replaced = 0;
+    int rows = 0;
+
+    for (int i = 0; i < document.rowsCount; i++)
+    {
+        int count = editorReplaceInRow(&document.rows[i], query, queryLen, flags, replacement, replacementLen,
+                                       &matches, &matchesSize);
+
+        replaced += count;
+        rows += count > 0;
+    }
+
+    if (rows > 0)
+    {
+        document.dirty++;
+        document.version++;
+
+        // rows off screen may wrap differently now, catch up in the background
+        if (config.softWrap)
+            document.rewrapNext = 0;
+
+        if (config.cursorY < document.rowsCount && config.cursorX > document.rows[config.cursorY].len)
+            config.cursorX = document.rows[config.cursorY].len;
+    }
+
+    editorSetHighlight(NULL, 0);
+    editorSetStatusMessage("Replaced %ld occurrences in %d rows", replaced, rows);
+
+    free(matches);
+    free(replacement);
+    free(query);
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [-d none|data|full] [-a seconds] [-l] [filename]\n", program);
+    exit(1);
 }
 
 int main(int argc, char *argv[])
 {
+    int opt;
+    config.durability = DURABILITY_NONE;
+    config.autosaveInterval = 0;
+
+    while ((opt = getopt(argc, argv, "d:a:l")) != -1)
+    {
+        switch (opt)
+        {
+        case 'd':
+            if (strcmp(optarg, "none") == 0)
+                config.durability = DURABILITY_NONE;
+            else if (strcmp(optarg, "data") == 0)
+                config.durability = DURABILITY_DATA;
+            else if (strcmp(optarg, "full") == 0)
+                config.durability = DURABILITY_FULL;
+            else
+                usage(argv[0]);
+            break;
+        case 'a':
+            config.autosaveInterval = atoi(optarg);
+            break;
+        case 'l':
+            config.latencyReport = 1;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
     if (enableRawMode(&config.origTermios) != 0)
         die("enableRawMode");
 
+    // handlers run in reverse order, the report is printed once the terminal is reset
+    atexit(editorReportLatency);
     atexit(resetTerminal);
+    enableBracketedPaste();
     initEditor();
 
-    if (argc >= 2)
-        editorOpen(argv[1]);
+    if (optind < argc)
+        editorOpen(argv[optind]);
 
-    editorSetStatusMessage("HELP : Ctrl+S = save | Ctrl+F = find | Ctrl+Q = quit");
+    editorSetStatusMessage("HELP : ^S save ^F find ^G regex ^R replace ^T case ^W wrap ^P latency ^Q quit");
 
     while (1)
     {
         editorRefreshScreen();
-        editorProcessKeyPress();
+
+        // process every key already buffered (e.g. a paste) before drawing again,
+        // but still draw at least every MAX_FRAME_INTERVAL_MS during long bursts
+        double frameStart = monotonicMs();
+
+        do
+        {
+            editorProcessKeyPress();
+            latencyKeysProcessed(&config.latency, monotonicMs());
+        } while (editorKeyPending() && monotonicMs() - frameStart < MAX_FRAME_INTERVAL_MS);
     }
 
     return 0;
@@ -0,0 +1,97 @@
+#define _GNU_SOURCE
+
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+
+#include "eventloop.h"
+
+int eventLoopInit(EventLoop *loop)
+{
+    loop->sourcesCount = 0;
+    loop->epollFd = epoll_create1(EPOLL_CLOEXEC);
+
+    return loop->epollFd == -1 ? -1 : 0;
+}
+
+int eventLoopAdd(EventLoop *loop, int fd, EventHandler handler)
+{
+    if (loop->sourcesCount == EVENT_LOOP_MAX_SOURCES)
+        return -1;
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u32 = loop->sourcesCount;
+
+    if (epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, fd, &event) == -1)
+        return -1;
+
+    loop->sources[loop->sourcesCount].fd = fd;
+    loop->sources[loop->sourcesCount].handler = handler;
+    loop->sourcesCount++;
+
+    return 0;
+}
+
+int eventLoopRun(EventLoop *loop, int timeoutMs)
+{
+    struct epoll_event events[EVENT_LOOP_MAX_SOURCES];
+    int n = epoll_wait(loop->epollFd, events, EVENT_LOOP_MAX_SOURCES, timeoutMs);
+
+    if (n == -1)
+        return errno == EINTR ? 0 : -1;
+
+    for (int i = 0; i < n; i++)
+    {
+        const EventSource *source = &loop->sources[events[i].data.u32];
+
+        if (source->handler)
+            source->handler(source->fd);
+    }
+
+    return n;
+}
+
+int timerCreate()
+{
+    return timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+}
+
+int timerArm(int fd, long ms, long intervalMs)
+{
+    struct itimerspec spec;
+    spec.it_value.tv_sec = ms / 1000;
+    spec.it_value.tv_nsec = (ms % 1000) * 1000000;
+    spec.it_interval.tv_sec = intervalMs / 1000;
+    spec.it_interval.tv_nsec = (intervalMs % 1000) * 1000000;
+
+    return timerfd_settime(fd, 0, &spec, NULL);
+}
+
+void timerAck(int fd)
+{
+    uint64_t expirations;
+    read(fd, &expirations, sizeof(expirations));
+}
+
+int signalCreate(int signo)
+{
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, signo);
+
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1)
+        return -1;
+
+    return signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+}
+
+void signalAck(int fd)
+{
+    struct signalfd_siginfo info;
+    read(fd, &info, sizeof(info));
+}
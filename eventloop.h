@@ -0,0 +1,67 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#define EVENT_LOOP_MAX_SOURCES 8
+
+typedef void (*EventHandler)(int fd);
+
+typedef struct EventSource
+{
+    int fd;
+    EventHandler handler;
+} EventSource;
+
+/*
+* epoll based loop over a few file descriptors : the terminal, a signalfd and
+* timerfds. The process sleeps in epoll_wait until one of them is ready, so
+* nothing runs while the editor is idle.
+*/
+typedef struct EventLoop
+{
+    int epollFd;
+    int sourcesCount;
+    EventSource sources[EVENT_LOOP_MAX_SOURCES];
+} EventLoop;
+
+int eventLoopInit(EventLoop *loop);
+
+/*
+* Watch fd for input. handler is called with fd when it becomes readable,
+* it may be NULL for sources that are read by the caller once eventLoopRun returns.
+*/
+int eventLoopAdd(EventLoop *loop, int fd, EventHandler handler);
+
+/*
+* Wait up to timeoutMs (-1 for ever) for ready sources and call their handlers.
+* Returns the number of ready sources or -1 on error.
+*/
+int eventLoopRun(EventLoop *loop, int timeoutMs);
+
+/*
+* Create a monotonic timerfd. Returns -1 on error.
+*/
+int timerCreate();
+
+/*
+* Arm the timer to expire in ms milliseconds, then every intervalMs if not 0.
+* A delay of 0 disarms the timer.
+*/
+int timerArm(int fd, long ms, long intervalMs);
+
+/*
+* Consume the expirations of a timer that fired.
+*/
+void timerAck(int fd);
+
+/*
+* Block signo and return a signalfd becoming readable when it is delivered.
+* Returns -1 on error.
+*/
+int signalCreate(int signo);
+
+/*
+* Consume a pending signal of a signalfd.
+*/
+void signalAck(int fd);
+
+#endif
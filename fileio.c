@@ -0,0 +1,140 @@
+#define _GNU_SOURCE
+
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+
+#include "fileio.h"
+
+#define COPY_CHUNK_SIZE (1 << 16)
+
+int writeAll(int fd, const char *buffer, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, buffer, len);
+
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                struct pollfd pfd = {fd, POLLOUT, 0};
+
+                if (poll(&pfd, 1, -1) == -1 && errno != EINTR)
+                    return -1;
+
+                continue;
+            }
+
+            return -1;
+        }
+
+        buffer += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+static int copyFileRangeFallback(int inFd, off_t inOffset, int outFd, off_t len)
+{
+    char buffer[COPY_CHUNK_SIZE];
+
+    while (len > 0)
+    {
+        ssize_t n = pread(inFd, buffer, len < COPY_CHUNK_SIZE ? len : COPY_CHUNK_SIZE, inOffset);
+
+        if (n == -1 && errno == EINTR)
+            continue;
+
+        if (n <= 0)
+        {
+            // the source got shorter than expected
+            if (n == 0)
+                errno = EIO;
+
+            return -1;
+        }
+
+        if (writeAll(outFd, buffer, n) == -1)
+            return -1;
+
+        inOffset += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+int copyFileRange(int inFd, off_t inOffset, int outFd, off_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = copy_file_range(inFd, &inOffset, outFd, NULL, len, 0);
+
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+
+            if (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP)
+                return copyFileRangeFallback(inFd, inOffset, outFd, len);
+
+            return -1;
+        }
+
+        if (n == 0)
+        {
+            errno = EIO;
+            return -1;
+        }
+
+        len -= n;
+    }
+
+    return 0;
+}
+
+int copyFileAttributes(const char *path, const struct stat *st, int outFd)
+{
+    // changing the owner clears the setuid bits, so the mode goes last. When
+    // we may not give the file away, at least try to keep its group
+    if (fchown(outFd, st->st_uid, st->st_gid) == -1)
+        (void)fchown(outFd, -1, st->st_gid);
+
+    ssize_t listLen = listxattr(path, NULL, 0);
+    char *names = listLen > 0 ? malloc(listLen) : NULL;
+
+    if (names != NULL)
+    {
+        listLen = listxattr(path, names, listLen);
+
+        for (char *name = names; listLen > 0 && name < names + listLen; name += strlen(name) + 1)
+        {
+            ssize_t valueLen = getxattr(path, name, NULL, 0);
+            char *value = valueLen >= 0 ? malloc(valueLen + 1) : NULL;
+
+            if (value == NULL)
+                continue;
+
+            valueLen = getxattr(path, name, value, valueLen);
+
+            // security labels and the like may be refused, they are best effort
+            if (valueLen >= 0)
+                (void)fsetxattr(outFd, name, value, valueLen, 0);
+
+            free(value);
+        }
+
+        free(names);
+    }
+
+    return fchmod(outFd, st->st_mode & 07777);
+}
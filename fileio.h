@@ -0,0 +1,30 @@
+#ifndef FILE_IO_H
+#define FILE_IO_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/*
+* Write the whole buffer, retrying on partial writes and EINTR. On a
+* non-blocking fd, waits in poll for room when the write would block.
+*/
+int writeAll(int fd, const char *buffer, size_t len);
+
+/*
+* Append len bytes read from inFd at inOffset to the current position of outFd.
+* copy_file_range lets the kernel do the copy without a round trip through
+* user space. Extents are only shared on reflink filesystems (btrfs, xfs)
+* when both ranges are block aligned, which rarely holds once a row before
+* them changed length. When it is not available we fall back to a plain
+* read/write loop.
+*/
+int copyFileRange(int inFd, off_t inOffset, int outFd, off_t len);
+
+/*
+* Give outFd the owner, permissions and extended attributes (ACLs included)
+* of the file st was taken from at path. The owner and the attributes are
+* copied where we are allowed to, only a failure to set the mode is an error.
+*/
+int copyFileAttributes(const char *path, const struct stat *st, int outFd);
+
+#endif
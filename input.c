@@ -0,0 +1,382 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+#include "input.h"
+
+#define INPUT_MASK (INPUT_BUFFER_SIZE - 1)
+
+enum ParserState
+{
+    STATE_GROUND,
+    STATE_ESC,
+    STATE_CSI,
+    STATE_SS3,
+    STATE_DONE,
+    STATE_INVALID
+};
+
+enum ByteClass
+{
+    CLASS_ESC,
+    CLASS_OPEN_BRACKET,
+    CLASS_O,
+    CLASS_PARAM,        // 0x30 to 0x3F : digits, ';' ...
+    CLASS_INTERMEDIATE, // 0x20 to 0x2F
+    CLASS_FINAL,        // 0x40 to 0x7E
+    CLASS_OTHER,
+    CLASS_COUNT
+};
+
+// next state of the escape sequence parser for each state and byte class
+static const unsigned char TRANSITIONS[][CLASS_COUNT] = {
+    [STATE_ESC] = {
+        [CLASS_ESC] = STATE_INVALID,
+        [CLASS_OPEN_BRACKET] = STATE_CSI,
+        [CLASS_O] = STATE_SS3,
+        [CLASS_PARAM] = STATE_INVALID,
+        [CLASS_INTERMEDIATE] = STATE_INVALID,
+        [CLASS_FINAL] = STATE_INVALID,
+        [CLASS_OTHER] = STATE_INVALID,
+    },
+    [STATE_CSI] = {
+        [CLASS_ESC] = STATE_INVALID,
+        [CLASS_OPEN_BRACKET] = STATE_DONE,
+        [CLASS_O] = STATE_DONE,
+        [CLASS_PARAM] = STATE_CSI,
+        [CLASS_INTERMEDIATE] = STATE_CSI,
+        [CLASS_FINAL] = STATE_DONE,
+        [CLASS_OTHER] = STATE_INVALID,
+    },
+    [STATE_SS3] = {
+        [CLASS_ESC] = STATE_INVALID,
+        [CLASS_OPEN_BRACKET] = STATE_DONE,
+        [CLASS_O] = STATE_DONE,
+        [CLASS_PARAM] = STATE_DONE,
+        [CLASS_INTERMEDIATE] = STATE_INVALID,
+        [CLASS_FINAL] = STATE_DONE,
+        [CLASS_OTHER] = STATE_INVALID,
+    },
+};
+
+typedef struct KeySequence
+{
+    const char *sequence; // bytes following ESC
+    int key;
+} KeySequence;
+
+static const KeySequence SEQUENCES[] = {
+    {"[A", ARROW_UP},
+    {"[B", ARROW_DOWN},
+    {"[C", ARROW_RIGHT},
+    {"[D", ARROW_LEFT},
+    {"[H", HOME_KEY},
+    {"[F", END_KEY},
+    {"[1~", HOME_KEY},
+    {"[3~", DEL_KEY},
+    {"[4~", END_KEY},
+    {"[5~", PAGE_UP},
+    {"[6~", PAGE_DOWN},
+    {"[7~", HOME_KEY},
+    {"[8~", END_KEY},
+    {"OH", HOME_KEY},
+    {"OF", END_KEY},
+    {"[200~", PASTE_START},
+};
+
+typedef struct InputThread
+{
+    InputBuffer buffer;
+    KeyQueue *queue;
+    int fd;
+    int escTimeoutMs;
+    double readTime;
+} InputThread;
+
+static InputThread inputThread;
+
+static enum ByteClass byteClass(unsigned char c)
+{
+    if (c == ESC_CHAR)
+        return CLASS_ESC;
+    if (c == '[')
+        return CLASS_OPEN_BRACKET;
+    if (c == 'O')
+        return CLASS_O;
+    if (c >= 0x30 && c <= 0x3F)
+        return CLASS_PARAM;
+    if (c >= 0x20 && c <= 0x2F)
+        return CLASS_INTERMEDIATE;
+    if (c >= 0x40 && c <= 0x7E)
+        return CLASS_FINAL;
+
+    return CLASS_OTHER;
+}
+
+static unsigned char peek(const InputBuffer *in, unsigned i)
+{
+    return in->data[(in->head + i) & INPUT_MASK];
+}
+
+int inputFill(InputBuffer *in, int fd)
+{
+    unsigned space = INPUT_BUFFER_SIZE - inputBuffered(in);
+
+    if (space == 0)
+        return 0;
+
+    unsigned start = in->tail & INPUT_MASK;
+    unsigned first = INPUT_BUFFER_SIZE - start < space ? INPUT_BUFFER_SIZE - start : space;
+    struct iovec iov[2] = {
+        {&in->data[start], first},
+        {in->data, space - first},
+    };
+
+    ssize_t nread = readv(fd, iov, space > first ? 2 : 1);
+
+    if (nread == -1)
+        return errno == EAGAIN || errno == EINTR ? 0 : -1;
+
+    if (nread == 0)
+    {
+        errno = EIO;
+        return -1;
+    }
+
+    in->tail += nread;
+
+    return nread;
+}
+
+unsigned inputBuffered(const InputBuffer *in)
+{
+    return in->tail - in->head;
+}
+
+// key of a complete escape sequence of len bytes, ESC included
+static int lookupSequence(const InputBuffer *in, unsigned len)
+{
+    char sequence[INPUT_MAX_SEQUENCE];
+
+    for (unsigned i = 1; i < len; i++)
+        sequence[i - 1] = peek(in, i);
+
+    sequence[len - 1] = '\0';
+
+    for (unsigned i = 0; i < sizeof(SEQUENCES) / sizeof(SEQUENCES[0]); i++)
+        if (strcmp(SEQUENCES[i].sequence, sequence) == 0)
+            return SEQUENCES[i].key;
+
+    return ESC_CHAR;
+}
+
+int inputTakePaste(InputBuffer *in, StringBuffer *paste)
+{
+    static const char PASTE_END[] = "\x1b[201~";
+    const unsigned PASTE_END_LEN = sizeof(PASTE_END) - 1;
+
+    while (inputBuffered(in))
+    {
+        unsigned start = in->head & INPUT_MASK;
+        unsigned available = inputBuffered(in);
+        unsigned contiguous = INPUT_BUFFER_SIZE - start < available ? INPUT_BUFFER_SIZE - start : available;
+        const char *esc = memchr(&in->data[start], ESC_CHAR, contiguous);
+
+        if (!esc)
+        {
+            sbAppend(paste, &in->data[start], contiguous);
+            in->head += contiguous;
+            continue;
+        }
+
+        sbAppend(paste, &in->data[start], esc - &in->data[start]);
+        in->head += esc - &in->data[start];
+        available = inputBuffered(in);
+
+        unsigned matched = 0;
+
+        while (matched < PASTE_END_LEN && matched < available && peek(in, matched) == PASTE_END[matched])
+            matched++;
+
+        if (matched == PASTE_END_LEN)
+        {
+            in->head += PASTE_END_LEN;
+            return 1;
+        }
+
+        // the marker may be completed by the next read
+        if (matched == available)
+            return 0;
+
+        sbAppend(paste, esc, 1);
+        in->head++;
+    }
+
+    return 0;
+}
+
+static double monotonicMs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/*
+* Wait for input and read it, returns 0 on timeout (-1 waits forever) and -1
+* on error. A hung up terminal stays readable, so errors must stop the thread
+* rather than be polled again.
+*/
+static int readInput(InputThread *thread, int timeoutMs)
+{
+    struct pollfd pfd = {thread->fd, POLLIN, 0};
+    int ready = poll(&pfd, 1, timeoutMs);
+
+    if (ready == 0)
+        return 0;
+
+    if (ready == -1)
+        return errno == EINTR ? 1 : -1;
+
+    int nread = inputFill(&thread->buffer, thread->fd);
+
+    if (nread == -1)
+        return -1;
+
+    if (nread > 0)
+        thread->readTime = monotonicMs();
+
+    return 1;
+}
+
+static void pushKey(InputThread *thread, const KeyEvent *event)
+{
+    // the editor is busy, give it a moment
+    while (!keyQueuePush(thread->queue, event))
+    {
+        struct timespec pause = {0, 1000000};
+        nanosleep(&pause, NULL);
+    }
+}
+
+// hand the read error over to the editor, which dies with it
+static void *inputThreadFail(InputThread *thread)
+{
+    KeyEvent event = {READ_ERROR, monotonicMs(), NULL, 0, errno};
+
+    pushKey(thread, &event);
+
+    return NULL;
+}
+
+static void *inputThreadMain(void *arg)
+{
+    InputThread *thread = arg;
+    int flush = 0;
+
+    while (1)
+    {
+        KeyEvent event = {0, 0, NULL, 0, 0};
+
+        if ((event.key = inputNextKey(&thread->buffer, flush)) == INPUT_NONE)
+        {
+            int timeoutMs = inputBuffered(&thread->buffer) ? thread->escTimeoutMs : -1;
+            int result = readInput(thread, timeoutMs);
+
+            if (result == -1)
+                return inputThreadFail(thread);
+
+            flush = !result;
+            continue;
+        }
+
+        flush = 0;
+        event.readTime = thread->readTime;
+
+        if (event.key == PASTE_START)
+        {
+            StringBuffer paste = SB_INIT;
+
+            while (!inputTakePaste(&thread->buffer, &paste))
+            {
+                if (readInput(thread, -1) == -1)
+                {
+                    sbFree(&paste);
+                    return inputThreadFail(thread);
+                }
+            }
+
+            event.paste = paste.s;
+            event.pasteLen = paste.len;
+        }
+
+        pushKey(thread, &event);
+    }
+
+    return NULL;
+}
+
+int inputStartThread(KeyQueue *queue, int fd, int escTimeoutMs)
+{
+    pthread_t thread;
+
+    inputThread.queue = queue;
+    inputThread.fd = fd;
+    inputThread.escTimeoutMs = escTimeoutMs;
+
+    if (pthread_create(&thread, NULL, inputThreadMain, &inputThread) != 0)
+        return -1;
+
+    pthread_detach(thread);
+
+    return 0;
+}
+
+int inputNextKey(InputBuffer *in, int flush)
+{
+    unsigned available = inputBuffered(in);
+
+    if (available == 0)
+        return INPUT_NONE;
+
+    unsigned char c = peek(in, 0);
+
+    if (c != ESC_CHAR)
+    {
+        in->head++;
+        return c;
+    }
+
+    enum ParserState state = STATE_ESC;
+    unsigned len = 1;
+
+    while (len < available && len < INPUT_MAX_SEQUENCE)
+    {
+        state = TRANSITIONS[state][byteClass(peek(in, len))];
+
+        if (state == STATE_INVALID)
+            break;
+
+        len++;
+
+        if (state == STATE_DONE)
+        {
+            int key = lookupSequence(in, len);
+            in->head += len;
+            return key;
+        }
+    }
+
+    // a lone ESC, or ESC followed by something that does not start a sequence
+    if (state != STATE_INVALID && len < INPUT_MAX_SEQUENCE && !flush)
+        return INPUT_NONE;
+
+    in->head++;
+    return ESC_CHAR;
+}
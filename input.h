@@ -0,0 +1,90 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include "stringbuffer.h"
+#include "keyqueue.h"
+
+#define ESC_CHAR '\x1b'
+// must be a power of two
+#define INPUT_BUFFER_SIZE (1 << 16)
+// longest escape sequence we wait for before giving up on it
+#define INPUT_MAX_SEQUENCE 16
+// returned by inputNextKey when more bytes are needed to decode a key
+#define INPUT_NONE -1
+
+enum InputKey
+{
+    BACKSPACE = 127,
+    ARROW_UP = 1000,
+    ARROW_DOWN,
+    ARROW_LEFT,
+    ARROW_RIGHT,
+    PAGE_UP,
+    PAGE_DOWN,
+    HOME_KEY,
+    END_KEY,
+    DEL_KEY,
+    PASTE_START, // followed by the pasted text, see inputTakePaste
+    READ_ERROR   // the terminal can't be read anymore, last key of the thread
+};
+
+/*
+* Ring buffer of bytes read from the terminal. head is where the next key
+* starts, tail where the next read stores bytes. Both only grow, they are
+* masked when indexing data.
+*/
+typedef struct InputBuffer
+{
+    char data[INPUT_BUFFER_SIZE];
+    unsigned head;
+    unsigned tail;
+} InputBuffer;
+
+#define INPUT_BUFFER_INIT \
+    {                     \
+        {0}, 0, 0         \
+    }
+
+/*
+* Read as many bytes as available from fd into the free space of the buffer,
+* with a single readv even when the free space wraps around. Returns the
+* number of bytes read, 0 when none were available and -1 on error or at the
+* end of the input (errno is then EIO, the terminal hung up).
+*/
+int inputFill(InputBuffer *in, int fd);
+
+/*
+* Number of bytes waiting in the buffer.
+*/
+unsigned inputBuffered(const InputBuffer *in);
+
+/*
+* Decode the next key from the buffer and consume its bytes. Escape
+* sequences are recognized by a small state machine, then looked up in a
+* table of known sequences. Unknown sequences decode as ESC_CHAR.
+* Returns INPUT_NONE when the buffer is empty or ends with an incomplete
+* escape sequence, whose bytes are kept until more input arrives. When flush
+* is set such a sequence is given up on instead : its ESC is returned alone
+* (the user pressed the escape key) and the following bytes are decoded as
+* keys.
+*/
+int inputNextKey(InputBuffer *in, int flush);
+
+/*
+* After a PASTE_START key, move the pasted bytes from the buffer to paste up
+* to the end of paste marker (ESC [ 201 ~), which is consumed. Returns 1 once
+* the marker was found, 0 if the paste goes on in bytes not read yet.
+*/
+int inputTakePaste(InputBuffer *in, StringBuffer *paste);
+
+/*
+* Start a thread reading fd in blocks into its own input buffer, decoding
+* keys and pushing them with the time they were read to queue, so that a slow
+* terminal write never delays reading. A lone ESC is waited on for
+* escTimeoutMs. The text of a bracketed paste is collected by the thread and
+* handed over with its PASTE_START key. When reading fails the thread pushes
+* a READ_ERROR key and stops. Returns -1 if the thread could not be started.
+*/
+int inputStartThread(KeyQueue *queue, int fd, int escTimeoutMs);
+
+#endif
@@ -0,0 +1,61 @@
+#define _GNU_SOURCE
+
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+
+#include "keyqueue.h"
+
+#define KEY_QUEUE_MASK (KEY_QUEUE_SIZE - 1)
+
+int keyQueueInit(KeyQueue *queue)
+{
+    queue->head = 0;
+    queue->tail = 0;
+    queue->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    return queue->wakeFd == -1 ? -1 : 0;
+}
+
+int keyQueuePush(KeyQueue *queue, const KeyEvent *event)
+{
+    unsigned tail = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+    unsigned head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+
+    if (tail - head == KEY_QUEUE_SIZE)
+        return 0;
+
+    queue->events[tail & KEY_QUEUE_MASK] = *event;
+    __atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+
+    // wake up the consumer every time : checking whether it sleeps would race with it
+    uint64_t one = 1;
+    write(queue->wakeFd, &one, sizeof(one));
+
+    return 1;
+}
+
+int keyQueuePop(KeyQueue *queue, KeyEvent *event)
+{
+    unsigned head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+    unsigned tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+
+    if (head == tail)
+        return 0;
+
+    *event = queue->events[head & KEY_QUEUE_MASK];
+    __atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+
+    return 1;
+}
+
+int keyQueueEmpty(KeyQueue *queue)
+{
+    return __atomic_load_n(&queue->head, __ATOMIC_RELAXED) == __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+}
+
+void keyQueueAck(KeyQueue *queue)
+{
+    uint64_t count;
+    read(queue->wakeFd, &count, sizeof(count));
+}
@@ -0,0 +1,55 @@
+#ifndef KEYQUEUE_H
+#define KEYQUEUE_H
+
+// must be a power of two
+#define KEY_QUEUE_SIZE 1024
+
+typedef struct KeyEvent
+{
+    int key;
+    double readTime; // monotonic ms when the bytes of the key were read
+    char *paste;     // text of a PASTE_START key, owned by the consumer
+    unsigned pasteLen;
+    int error; // errno of a READ_ERROR key
+} KeyEvent;
+
+/*
+* Lock free single producer, single consumer queue of keys. The producer only
+* writes tail and the consumer only writes head, each published with release
+* stores and read with acquire loads. They are kept on separate cache lines so
+* that the two threads do not invalidate each other's line on every key.
+* The producer signals wakeFd, an eventfd the consumer can sleep on.
+*/
+typedef struct KeyQueue
+{
+    KeyEvent events[KEY_QUEUE_SIZE];
+    unsigned head;
+    char headPadding[64 - sizeof(unsigned)];
+    unsigned tail;
+    char tailPadding[64 - sizeof(unsigned)];
+    int wakeFd;
+} KeyQueue;
+
+/*
+* Returns -1 if the eventfd could not be created.
+*/
+int keyQueueInit(KeyQueue *queue);
+
+/*
+* Producer side. Returns 0 if the queue is full.
+*/
+int keyQueuePush(KeyQueue *queue, const KeyEvent *event);
+
+/*
+* Consumer side. Returns 0 if the queue is empty.
+*/
+int keyQueuePop(KeyQueue *queue, KeyEvent *event);
+
+int keyQueueEmpty(KeyQueue *queue);
+
+/*
+* Consumer side, reset wakeFd once it was signaled.
+*/
+void keyQueueAck(KeyQueue *queue);
+
+#endif
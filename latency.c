@@ -0,0 +1,115 @@
+#include "latency.h"
+
+const char *const LATENCY_PHASE_NAMES[LATENCY_PHASES] = {"process", "output", "total"};
+
+static int bucketOf(unsigned long us)
+{
+    if (us < LATENCY_SUB_BUCKETS)
+        return us;
+
+    // position of the most significant bit, at least log2(LATENCY_SUB_BUCKETS)
+    int msb = 0;
+
+    while (us >> (msb + 1))
+        msb++;
+
+    int shift = msb - LATENCY_SUB_BUCKET_BITS;
+    int bucket = (shift + 1) * LATENCY_SUB_BUCKETS + ((us >> shift) & (LATENCY_SUB_BUCKETS - 1));
+
+    return bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1;
+}
+
+// first value in microseconds of the bucket following the given one
+static double bucketEnd(int bucket)
+{
+    if (bucket < LATENCY_SUB_BUCKETS)
+        return bucket + 1;
+
+    int shift = bucket / LATENCY_SUB_BUCKETS - 1;
+    int sub = bucket % LATENCY_SUB_BUCKETS;
+
+    return (double)(LATENCY_SUB_BUCKETS + sub + 1) * (1UL << shift);
+}
+
+void latencyRecord(LatencyHistogram *histogram, double ms)
+{
+    if (ms < 0)
+        ms = 0;
+
+    histogram->counts[bucketOf(ms * 1000)]++;
+    histogram->count++;
+
+    if (ms > histogram->maxMs)
+        histogram->maxMs = ms;
+}
+
+double latencyPercentile(const LatencyHistogram *histogram, double percentile)
+{
+    if (histogram->count == 0)
+        return 0;
+
+    double rank = histogram->count * percentile / 100;
+    unsigned long seen = 0;
+
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        seen += histogram->counts[i];
+
+        if (seen >= rank && seen > 0)
+        {
+            double ms = bucketEnd(i) / 1000;
+            return ms < histogram->maxMs ? ms : histogram->maxMs;
+        }
+    }
+
+    return histogram->maxMs;
+}
+
+void latencyKeyRead(LatencyTracker *tracker, double nowMs)
+{
+    if (tracker->pendingCount == LATENCY_MAX_PENDING)
+        return;
+
+    tracker->pending[tracker->pendingCount].readMs = nowMs;
+    tracker->pending[tracker->pendingCount].processedMs = 0;
+    tracker->pending[tracker->pendingCount].framed = 0;
+    tracker->pendingCount++;
+}
+
+void latencyKeysProcessed(LatencyTracker *tracker, double nowMs)
+{
+    for (int i = tracker->pendingCount - 1; i >= 0 && tracker->pending[i].processedMs == 0; i--)
+    {
+        tracker->pending[i].processedMs = nowMs;
+        latencyRecord(&tracker->phases[LATENCY_PROCESS], nowMs - tracker->pending[i].readMs);
+    }
+}
+
+void latencyFrameComposed(LatencyTracker *tracker)
+{
+    for (int i = 0; i < tracker->pendingCount; i++)
+        tracker->pending[i].framed = tracker->pending[i].processedMs != 0;
+}
+
+void latencyFrameWritten(LatencyTracker *tracker, double nowMs)
+{
+    int kept = 0;
+
+    for (int i = 0; i < tracker->pendingCount; i++)
+    {
+        LatencyPendingKey *key = &tracker->pending[i];
+
+        // a key still being processed (e.g. in a prompt) or processed after the
+        // frame was composed waits for the next frame
+        if (!key->framed)
+        {
+            tracker->pending[kept++] = *key;
+            continue;
+        }
+
+        latencyRecord(&tracker->phases[LATENCY_OUTPUT], nowMs - key->processedMs);
+        latencyRecord(&tracker->phases[LATENCY_TOTAL], nowMs - key->readMs);
+    }
+
+    tracker->pendingCount = kept;
+}
@@ -0,0 +1,72 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+// values are counted in microseconds, 32 buckets per power of two (~3% precision)
+#define LATENCY_SUB_BUCKET_BITS 5
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BUCKET_BITS)
+#define LATENCY_BUCKETS 1024
+// keys waiting for their frame to be written, extra keys are not measured
+#define LATENCY_MAX_PENDING 256
+
+typedef struct LatencyHistogram
+{
+    unsigned long counts[LATENCY_BUCKETS];
+    unsigned long count;
+    double maxMs;
+} LatencyHistogram;
+
+void latencyRecord(LatencyHistogram *histogram, double ms);
+
+/*
+* Upper bound of the bucket holding the given percentile (0 to 100) of the
+* recorded values, in milliseconds. 0 when nothing was recorded.
+*/
+double latencyPercentile(const LatencyHistogram *histogram, double percentile);
+
+enum LatencyPhase
+{
+    LATENCY_PROCESS, // key read -> key processed
+    LATENCY_OUTPUT,  // key processed -> frame written
+    LATENCY_TOTAL,   // key read -> frame written
+    LATENCY_PHASES
+};
+
+typedef struct LatencyPendingKey
+{
+    double readMs;
+    double processedMs; // 0 while the key is being processed
+    int framed;         // its effect is in the frame being written
+} LatencyPendingKey;
+
+/*
+* Follows each key from the time it is read to the time the frame showing its
+* effect is written, with a histogram per phase. Times come from a monotonic
+* clock, in milliseconds.
+*/
+typedef struct LatencyTracker
+{
+    LatencyHistogram phases[LATENCY_PHASES];
+    LatencyPendingKey pending[LATENCY_MAX_PENDING];
+    int pendingCount;
+} LatencyTracker;
+
+void latencyKeyRead(LatencyTracker *tracker, double nowMs);
+
+/*
+* The keys read so far are processed.
+*/
+void latencyKeysProcessed(LatencyTracker *tracker, double nowMs);
+
+/*
+* A frame holding the effect of the processed keys was composed.
+*/
+void latencyFrameComposed(LatencyTracker *tracker);
+
+/*
+* The last composed frame was written, its keys reached the terminal.
+*/
+void latencyFrameWritten(LatencyTracker *tracker, double nowMs);
+
+extern const char *const LATENCY_PHASE_NAMES[LATENCY_PHASES];
+
+#endif
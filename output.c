@@ -0,0 +1,99 @@
+#define _GNU_SOURCE
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include "output.h"
+#include "fileio.h"
+
+static void *outputThread(void *arg)
+{
+    OutputWriter *writer = arg;
+
+    while (1)
+    {
+        uint64_t count;
+
+        if (read(writer->wakeFd, &count, sizeof(count)) != sizeof(count))
+            continue;
+
+        // errors are ignored : there is nobody to report them to but the terminal
+        writeAll(writer->fd, writer->frame.s, writer->frame.len);
+
+        __atomic_store_n(&writer->busy, 0, __ATOMIC_RELEASE);
+
+        uint64_t one = 1;
+        write(writer->doneFd, &one, sizeof(one));
+    }
+
+    return NULL;
+}
+
+int outputStart(OutputWriter *writer, int ttyFd)
+{
+    writer->frame = (StringBuffer)SB_INIT;
+    writer->busy = 0;
+
+    // O_NONBLOCK is set on a file description of our own : set on ttyFd it
+    // would be shared with stdin and the shell the editor was started from
+    char *path = ttyname(ttyFd);
+    writer->fd = path == NULL ? -1 : open(path, O_WRONLY | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
+
+    if (writer->fd == -1)
+        writer->fd = ttyFd;
+
+    writer->wakeFd = eventfd(0, EFD_CLOEXEC);
+    writer->doneFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (writer->wakeFd == -1 || writer->doneFd == -1)
+        return -1;
+
+    pthread_t thread;
+
+    if (pthread_create(&thread, NULL, outputThread, writer) != 0)
+        return -1;
+
+    pthread_detach(thread);
+
+    return 0;
+}
+
+int outputBusy(OutputWriter *writer)
+{
+    return __atomic_load_n(&writer->busy, __ATOMIC_ACQUIRE);
+}
+
+int outputSubmit(OutputWriter *writer, StringBuffer *frame)
+{
+    if (outputBusy(writer))
+        return 0;
+
+    StringBuffer previous = writer->frame;
+    writer->frame = *frame;
+    *frame = previous;
+
+    __atomic_store_n(&writer->busy, 1, __ATOMIC_RELEASE);
+
+    uint64_t one = 1;
+    write(writer->wakeFd, &one, sizeof(one));
+
+    return 1;
+}
+
+void outputAck(OutputWriter *writer)
+{
+    uint64_t count;
+    read(writer->doneFd, &count, sizeof(count));
+}
+
+void outputDrain(OutputWriter *writer)
+{
+    struct timespec pause = {0, 1000000};
+
+    while (outputBusy(writer))
+        nanosleep(&pause, NULL);
+}
@@ -0,0 +1,51 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include "stringbuffer.h"
+
+/*
+* Frames are written to the terminal by a dedicated thread, through a
+* non-blocking descriptor of its own, so that a slow terminal (e.g. over a
+* congested ssh link) never blocks the main thread and the keys it processes.
+* One frame is in flight at a time : the main thread does not compose frames
+* while the writer is busy, the states in between are dropped and the latest
+* one is drawn once doneFd signals the frame went out. This also keeps the
+* screen diff consistent, every composed frame reaches the terminal.
+*/
+typedef struct OutputWriter
+{
+    int fd;
+    StringBuffer frame; // owned by the writer thread while busy
+    int busy;
+    int wakeFd; // eventfd the writer thread sleeps on
+    int doneFd; // eventfd signaled when a frame was fully written
+} OutputWriter;
+
+/*
+* Open the terminal behind ttyFd and start the writer thread. When it is not a
+* terminal, the frames are written to ttyFd itself in blocking mode.
+* Returns -1 on error.
+*/
+int outputStart(OutputWriter *writer, int ttyFd);
+
+int outputBusy(OutputWriter *writer);
+
+/*
+* Hand frame to the writer thread, swapping it with the buffer of the
+* previous frame so that neither is reallocated.
+* Returns 0 without taking the frame if the writer is busy.
+*/
+int outputSubmit(OutputWriter *writer, StringBuffer *frame);
+
+/*
+* Reset doneFd once it was signaled.
+*/
+void outputAck(OutputWriter *writer);
+
+/*
+* Wait until the frame in flight is written, before writing to the terminal
+* from another thread.
+*/
+void outputDrain(OutputWriter *writer);
+
+#endif
@@ -0,0 +1,69 @@
+#include <stdlib.h>
+
+#include "prefixsum.h"
+
+void prefixSumBuild(PrefixSum *ps, int count, int (*value)(int at))
+{
+    free(ps->tree);
+
+    ps->count = count;
+    ps->tree = malloc(sizeof(long) * (count + 1));
+    ps->tree[0] = 0;
+
+    for (int i = 1; i <= count; i++)
+        ps->tree[i] = value(i - 1);
+
+    // push each node into its parent
+    for (int i = 1; i <= count; i++)
+    {
+        int parent = i + (i & -i);
+
+        if (parent <= count)
+            ps->tree[parent] += ps->tree[i];
+    }
+}
+
+void prefixSumAdd(PrefixSum *ps, int at, long delta)
+{
+    for (int i = at + 1; i <= ps->count; i += i & -i)
+        ps->tree[i] += delta;
+}
+
+long prefixSumQuery(const PrefixSum *ps, int at)
+{
+    long sum = 0;
+
+    for (int i = at; i > 0; i -= i & -i)
+        sum += ps->tree[i];
+
+    return sum;
+}
+
+int prefixSumSearch(const PrefixSum *ps, long pos)
+{
+    int at = 0;
+    int step = 1;
+
+    while (step * 2 <= ps->count)
+        step *= 2;
+
+    // descend the implicit tree, at is the number of values known to end before pos
+    for (; step > 0; step /= 2)
+    {
+        if (at + step <= ps->count && ps->tree[at + step] <= pos)
+        {
+            at += step;
+            pos -= ps->tree[at];
+        }
+    }
+
+    return at;
+}
+
+void prefixSumFree(PrefixSum *ps)
+{
+    free(ps->tree);
+
+    ps->tree = NULL;
+    ps->count = 0;
+}
@@ -0,0 +1,37 @@
+#ifndef PREFIX_SUM_H
+#define PREFIX_SUM_H
+
+/*
+* Fenwick tree over count values : point updates and prefix sums are O(log n),
+* and so is finding the value containing a given position in the running sum.
+*/
+typedef struct PrefixSum
+{
+    int count;
+    long *tree;
+} PrefixSum;
+
+/*
+* Build the tree from value(0) .. value(count - 1) in O(n).
+*/
+void prefixSumBuild(PrefixSum *ps, int count, int (*value)(int at));
+
+/*
+* Add delta to the value at index at.
+*/
+void prefixSumAdd(PrefixSum *ps, int at, long delta);
+
+/*
+* Sum of the values before index at.
+*/
+long prefixSumQuery(const PrefixSum *ps, int at);
+
+/*
+* Index of the value containing position pos of the running sum, i.e. the
+* largest at with prefixSumQuery(at) <= pos. Returns count if pos is past the end.
+*/
+int prefixSumSearch(const PrefixSum *ps, long pos);
+
+void prefixSumFree(PrefixSum *ps);
+
+#endif
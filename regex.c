@@ -0,0 +1,1211 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "regex.h"
+#include "search.h"
+
+// groups and repetitions nested deeper than this are rejected, the parser
+// and the compiler recurse into them. Sequences and alternatives are chained
+// to the right and walked in loops, so their length does not count
+#define REGEX_MAX_DEPTH 256
+#define REGEX_MAX_REPEAT 1000
+// most nodes emit an instruction, a pattern with many more can't compile anyway
+#define REGEX_MAX_NODES (4 * REGEX_MAX_INSTRUCTIONS)
+
+enum RegexNodeType
+{
+    NODE_EMPTY,
+    NODE_BYTE,
+    NODE_SET,
+    NODE_ANY,
+    NODE_BOL,
+    NODE_EOL,
+    NODE_CAT,
+    NODE_ALT,
+    NODE_REPEAT
+};
+
+typedef struct RegexNode
+{
+    int type;
+    int a; // children
+    int b;
+    int min; // repetition bounds, max is -1 when unbounded
+    int max;
+    int greedy;
+    unsigned char byte;
+    int set;
+} RegexNode;
+
+typedef struct RegexParser
+{
+    const char *s;
+    size_t len;
+    size_t at;
+    int depth;
+    RegexNode *nodes;
+    int count;
+    int size;
+    Regex *re;
+} RegexParser;
+
+static int regexParseAlt(RegexParser *p);
+
+static int regexNode(RegexParser *p, int type)
+{
+    // the parser stops at the error, a few more nodes are made while it unwinds
+    if (p->count == REGEX_MAX_NODES)
+        p->re->error = "pattern too large";
+
+    if (p->count == p->size)
+    {
+        p->size = p->size ? p->size * 2 : 64;
+        p->nodes = realloc(p->nodes, p->size * sizeof(RegexNode));
+    }
+
+    RegexNode *node = &p->nodes[p->count];
+    memset(node, 0, sizeof(*node));
+    node->type = type;
+
+    return p->count++;
+}
+
+static int regexPair(RegexParser *p, int type, int a, int b)
+{
+    int n = regexNode(p, type);
+    p->nodes[n].a = a;
+    p->nodes[n].b = b;
+
+    return n;
+}
+
+static int regexNewSet(Regex *re)
+{
+    re->sets = realloc(re->sets, (re->setsCount + 1) * sizeof(*re->sets));
+    memset(re->sets[re->setsCount], 0, sizeof(*re->sets));
+
+    return re->setsCount++;
+}
+
+static void regexSetRange(Regex *re, int set, int first, int last)
+{
+    for (int c = first; c <= last; c++)
+        re->sets[set][c >> 3] |= 1 << (c & 7);
+}
+
+static int regexSetHas(const Regex *re, int set, unsigned char c)
+{
+    return re->sets[set][c >> 3] & (1 << (c & 7));
+}
+
+static int regexIsLetter(unsigned char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+// add the other case of the letters of set
+static void regexSetFoldCase(Regex *re, int set)
+{
+    for (int c = 0; c < 256; c++)
+        if (regexIsLetter(c) && regexSetHas(re, set, c))
+            regexSetRange(re, set, c ^ 0x20, c ^ 0x20);
+}
+
+// the lower case letter if set holds exactly its two cases, 0 otherwise
+static unsigned char regexSetLetter(const Regex *re, int set)
+{
+    int count = 0;
+    unsigned char letter = 0;
+
+    for (int c = 0; c < 256; c++)
+    {
+        if (regexSetHas(re, set, c))
+        {
+            count++;
+            letter = c | 0x20;
+        }
+    }
+
+    return count == 2 && regexIsLetter(letter) && regexSetHas(re, set, letter) && regexSetHas(re, set, letter ^ 0x20)
+               ? letter
+               : 0;
+}
+
+// the bytes of \d \w \s, upper case letters negate them. Returns 0 for other escapes
+static int regexEscapeSet(Regex *re, int set, char c)
+{
+    int negate = c == 'D' || c == 'W' || c == 'S';
+    int target = negate ? regexNewSet(re) : set;
+
+    switch (c)
+    {
+    case 'd':
+    case 'D':
+        regexSetRange(re, target, '0', '9');
+        break;
+    case 'w':
+    case 'W':
+        regexSetRange(re, target, '0', '9');
+        regexSetRange(re, target, 'A', 'Z');
+        regexSetRange(re, target, 'a', 'z');
+        regexSetRange(re, target, '_', '_');
+        break;
+    case 's':
+    case 'S':
+        regexSetRange(re, target, '\t', '\r');
+        regexSetRange(re, target, ' ', ' ');
+        break;
+    default:
+        return 0;
+    }
+
+    if (negate)
+    {
+        for (int i = 0; i < 32; i++)
+            re->sets[set][i] |= ~re->sets[target][i];
+
+        re->setsCount--;
+    }
+
+    return 1;
+}
+
+static unsigned char regexEscapeByte(char c)
+{
+    switch (c)
+    {
+    case 'n':
+        return '\n';
+    case 'r':
+        return '\r';
+    case 't':
+        return '\t';
+    case 'f':
+        return '\f';
+    case 'v':
+        return '\v';
+    default:
+        return c;
+    }
+}
+
+// a byte of a class, or -1 if it was an escape adding a whole set
+static int regexParseClassByte(RegexParser *p, int set)
+{
+    char c = p->s[p->at++];
+
+    if (c != '\\')
+        return (unsigned char)c;
+
+    if (p->at == p->len)
+    {
+        p->re->error = "trailing \\";
+        return -1;
+    }
+
+    c = p->s[p->at++];
+
+    return regexEscapeSet(p->re, set, c) ? -1 : regexEscapeByte(c);
+}
+
+static int regexParseClass(RegexParser *p)
+{
+    int set = regexNewSet(p->re);
+    int negate = p->at < p->len && p->s[p->at] == '^';
+
+    if (negate)
+        p->at++;
+
+    // a ] right after [ or [^ is a literal
+    for (int first = 1; p->at < p->len && (p->s[p->at] != ']' || first) && !p->re->error; first = 0)
+    {
+        int low = regexParseClassByte(p, set);
+
+        if (low == -1)
+            continue;
+
+        int high = low;
+
+        if (p->at + 1 < p->len && p->s[p->at] == '-' && p->s[p->at + 1] != ']')
+        {
+            p->at++;
+            high = regexParseClassByte(p, set);
+
+            if (high < low)
+            {
+                p->re->error = "invalid class range";
+                return -1;
+            }
+        }
+
+        regexSetRange(p->re, set, low, high);
+    }
+
+    if (p->re->error)
+        return -1;
+
+    if (p->at == p->len)
+    {
+        p->re->error = "missing ]";
+        return -1;
+    }
+
+    p->at++;
+
+    // before negating : [^a] excludes A as well
+    if (p->re->ignoreCase)
+        regexSetFoldCase(p->re, set);
+
+    if (negate)
+        for (int i = 0; i < 32; i++)
+            p->re->sets[set][i] = ~p->re->sets[set][i];
+
+    int n = regexNode(p, NODE_SET);
+    p->nodes[n].set = set;
+
+    return n;
+}
+
+static int regexParseNumber(RegexParser *p, int *value)
+{
+    size_t start = p->at;
+    *value = 0;
+
+    // past the limit the value only has to stay too large
+    for (; p->at < p->len && p->s[p->at] >= '0' && p->s[p->at] <= '9'; p->at++)
+        if (*value <= REGEX_MAX_REPEAT)
+            *value = *value * 10 + (p->s[p->at] - '0');
+
+    return p->at > start;
+}
+
+// {n} {n,} {n,m}, anything else leaves the { to be parsed as a literal
+static int regexParseBounds(RegexParser *p, int *min, int *max)
+{
+    size_t start = p->at++;
+
+    if (regexParseNumber(p, min))
+    {
+        *max = *min;
+
+        if (p->at < p->len && p->s[p->at] == ',')
+        {
+            p->at++;
+            int bound;
+            *max = regexParseNumber(p, &bound) ? bound : -1;
+        }
+
+        if (p->at < p->len && p->s[p->at] == '}')
+        {
+            p->at++;
+            return 1;
+        }
+    }
+
+    p->at = start;
+
+    return 0;
+}
+
+static int regexParseAtom(RegexParser *p)
+{
+    char c = p->s[p->at++];
+    int n;
+
+    switch (c)
+    {
+    case '(':
+        if (++p->depth > REGEX_MAX_DEPTH)
+        {
+            p->re->error = "too many nested groups";
+            return -1;
+        }
+
+        if (p->at + 1 < p->len && p->s[p->at] == '?' && p->s[p->at + 1] == ':')
+            p->at += 2;
+
+        n = regexParseAlt(p);
+        p->depth--;
+
+        if (!p->re->error && (p->at == p->len || p->s[p->at] != ')'))
+            p->re->error = "missing )";
+
+        p->at++;
+        return n;
+    case '*':
+    case '+':
+    case '?':
+        p->re->error = "nothing to repeat";
+        return -1;
+    case '[':
+        return regexParseClass(p);
+    case '.':
+        return regexNode(p, NODE_ANY);
+    case '^':
+        return regexNode(p, NODE_BOL);
+    case '$':
+        return regexNode(p, NODE_EOL);
+    case '\\':
+        if (p->at == p->len)
+        {
+            p->re->error = "trailing \\";
+            return -1;
+        }
+
+        c = p->s[p->at++];
+        n = regexNode(p, NODE_SET);
+        p->nodes[n].set = regexNewSet(p->re);
+
+        if (regexEscapeSet(p->re, p->nodes[n].set, c))
+            return n;
+
+        p->re->setsCount--;
+        p->nodes[n].type = NODE_BYTE;
+        p->nodes[n].byte = regexEscapeByte(c);
+        return n;
+    default:
+        n = regexNode(p, NODE_BYTE);
+        p->nodes[n].byte = c;
+        return n;
+    }
+}
+
+static int regexParseRepeat(RegexParser *p)
+{
+    int n = regexParseAtom(p);
+    int depth = p->depth;
+
+    while (!p->re->error && p->at < p->len)
+    {
+        int min, max;
+        char c = p->s[p->at];
+
+        if (c == '*')
+            min = 0, max = -1;
+        else if (c == '+')
+            min = 1, max = -1;
+        else if (c == '?')
+            min = 0, max = 1;
+        else if (c != '{' || !regexParseBounds(p, &min, &max))
+            break;
+
+        if (c != '{')
+            p->at++;
+
+        if (min > REGEX_MAX_REPEAT || max > REGEX_MAX_REPEAT || (max != -1 && max < min))
+        {
+            p->re->error = "invalid repetition";
+            return -1;
+        }
+
+        if (++p->depth > REGEX_MAX_DEPTH)
+        {
+            p->re->error = "too many nested repetitions";
+            return -1;
+        }
+
+        n = regexPair(p, NODE_REPEAT, n, -1);
+        p->nodes[n].min = min;
+        p->nodes[n].max = max;
+        p->nodes[n].greedy = 1;
+
+        if (p->at < p->len && p->s[p->at] == '?')
+        {
+            p->nodes[n].greedy = 0;
+            p->at++;
+        }
+    }
+
+    p->depth = depth;
+
+    return n;
+}
+
+/*
+* Append next to the chain of type nodes starting at n, whose last link is
+* tail (-1 while n is a single node). Chains lean right : a b c is
+* CAT(a, CAT(b, c)), so that the compiler walks them in a loop.
+*/
+static int regexChain(RegexParser *p, int type, int n, int *tail, int next)
+{
+    if (*tail == -1)
+    {
+        *tail = regexPair(p, type, n, next);
+        return *tail;
+    }
+
+    int link = regexPair(p, type, p->nodes[*tail].b, next);
+    p->nodes[*tail].b = link;
+    *tail = link;
+
+    return n;
+}
+
+static int regexParseConcat(RegexParser *p)
+{
+    int n = -1;
+    int tail = -1;
+
+    while (!p->re->error && p->at < p->len && p->s[p->at] != '|' && p->s[p->at] != ')')
+    {
+        int next = regexParseRepeat(p);
+        n = n == -1 ? next : regexChain(p, NODE_CAT, n, &tail, next);
+    }
+
+    return n == -1 ? regexNode(p, NODE_EMPTY) : n;
+}
+
+static int regexParseAlt(RegexParser *p)
+{
+    int n = regexParseConcat(p);
+    int tail = -1;
+
+    while (!p->re->error && p->at < p->len && p->s[p->at] == '|')
+    {
+        p->at++;
+        n = regexChain(p, NODE_ALT, n, &tail, regexParseConcat(p));
+    }
+
+    return n;
+}
+
+// index of the new instruction, or of a scratch one past the end once the program is full
+static int regexEmit(Regex *re, int op)
+{
+    if (re->count == REGEX_MAX_INSTRUCTIONS)
+    {
+        re->error = "pattern too large";
+        return REGEX_MAX_INSTRUCTIONS;
+    }
+
+    memset(&re->program[re->count], 0, sizeof(RegexInst));
+    re->program[re->count].op = op;
+
+    return re->count++;
+}
+
+static void regexCompileNode(Regex *re, const RegexNode *nodes, int n, int anySets[2])
+{
+    const RegexNode *node = &nodes[n];
+    int pc, loop;
+
+    if (re->error)
+        return;
+
+    switch (node->type)
+    {
+    case NODE_EMPTY:
+        break;
+    case NODE_BYTE:
+        if (re->ignoreCase && regexIsLetter(node->byte))
+        {
+            pc = regexEmit(re, REGEX_SET);
+            re->program[pc].x = regexNewSet(re);
+            regexSetRange(re, re->program[pc].x, node->byte | 0x20, node->byte | 0x20);
+            regexSetRange(re, re->program[pc].x, node->byte & ~0x20, node->byte & ~0x20);
+            break;
+        }
+
+        re->program[regexEmit(re, REGEX_BYTE)].byte = node->byte;
+        break;
+    case NODE_SET:
+        re->program[regexEmit(re, REGEX_SET)].x = node->set;
+        break;
+    case NODE_ANY:
+        // any byte followed by the continuation bytes of its UTF-8 sequence
+        re->program[regexEmit(re, REGEX_SET)].x = anySets[0];
+        loop = regexEmit(re, REGEX_SPLIT);
+        re->program[regexEmit(re, REGEX_SET)].x = anySets[1];
+        re->program[regexEmit(re, REGEX_JMP)].x = loop;
+        re->program[loop].x = loop + 1;
+        re->program[loop].y = re->count;
+        break;
+    case NODE_BOL:
+        regexEmit(re, REGEX_BOL);
+        break;
+    case NODE_EOL:
+        regexEmit(re, REGEX_EOL);
+        break;
+    case NODE_CAT:
+        for (; node->type == NODE_CAT; node = &nodes[node->b])
+            regexCompileNode(re, nodes, node->a, anySets);
+
+        regexCompileNode(re, nodes, node - nodes, anySets);
+        break;
+    case NODE_ALT:
+        // a split before every alternative but the last, each one ends with
+        // a jump to the end. The jumps are chained through x until then
+        loop = -1;
+
+        for (; node->type == NODE_ALT; node = &nodes[node->b])
+        {
+            pc = regexEmit(re, REGEX_SPLIT);
+            re->program[pc].x = pc + 1;
+            regexCompileNode(re, nodes, node->a, anySets);
+            int jump = regexEmit(re, REGEX_JMP);
+            re->program[jump].x = loop;
+            loop = jump;
+            re->program[pc].y = re->count;
+        }
+
+        regexCompileNode(re, nodes, node - nodes, anySets);
+
+        while (!re->error && loop != -1)
+        {
+            pc = re->program[loop].x;
+            re->program[loop].x = re->count;
+            loop = pc;
+        }
+        break;
+    case NODE_REPEAT:
+        for (int i = 0; i < node->min - (node->max == -1 && node->min > 0); i++)
+            regexCompileNode(re, nodes, node->a, anySets);
+
+        if (node->max == -1 && node->min > 0)
+        {
+            // x+ : x, then back to x or on
+            loop = re->count;
+            regexCompileNode(re, nodes, node->a, anySets);
+            pc = regexEmit(re, REGEX_SPLIT);
+            re->program[pc].x = node->greedy ? loop : pc + 1;
+            re->program[pc].y = node->greedy ? pc + 1 : loop;
+        }
+        else if (node->max == -1)
+        {
+            // x* : x and back, or on
+            pc = regexEmit(re, REGEX_SPLIT);
+            regexCompileNode(re, nodes, node->a, anySets);
+            re->program[regexEmit(re, REGEX_JMP)].x = pc;
+            re->program[pc].x = node->greedy ? pc + 1 : re->count;
+            re->program[pc].y = node->greedy ? re->count : pc + 1;
+        }
+
+        // x? as many times as optional copies are allowed
+        for (int i = node->min; i < node->max; i++)
+        {
+            pc = regexEmit(re, REGEX_SPLIT);
+            regexCompileNode(re, nodes, node->a, anySets);
+            re->program[pc].x = node->greedy ? pc + 1 : re->count;
+            re->program[pc].y = node->greedy ? re->count : pc + 1;
+        }
+        break;
+    }
+}
+
+// split the bytes into the classes of bytes every instruction treats the same
+static void regexComputeClasses(Regex *re)
+{
+    int renamed[256][2];
+
+    memset(re->classes, 0, sizeof(re->classes));
+    re->classesCount = 1;
+
+    for (int pc = 0; pc < re->count; pc++)
+    {
+        const RegexInst *inst = &re->program[pc];
+
+        if (inst->op != REGEX_BYTE && inst->op != REGEX_SET)
+            continue;
+
+        int count = 0;
+        memset(renamed, -1, sizeof(renamed));
+
+        for (int c = 0; c < 256; c++)
+        {
+            int in = inst->op == REGEX_BYTE ? c == inst->byte : regexSetHas(re, inst->x, c) != 0;
+            int *name = &renamed[re->classes[c]][in];
+
+            if (*name == -1)
+                *name = count++;
+
+            re->classes[c] = *name;
+        }
+
+        re->classesCount = count;
+    }
+}
+
+// the literal bytes at the start of the program, and whether it starts with ^
+static void regexComputePrefix(Regex *re)
+{
+    int pc = 0;
+
+    re->anchored = re->program[0].op == REGEX_BOL;
+
+    while (re->program[pc].op == REGEX_BOL)
+        pc++;
+
+    re->prefix = malloc(re->count);
+    re->prefixLen = 0;
+
+    for (;; pc++)
+    {
+        const RegexInst *inst = &re->program[pc];
+
+        if (inst->op == REGEX_BYTE)
+            re->prefix[re->prefixLen++] = inst->byte;
+        else if (re->ignoreCase && inst->op == REGEX_SET && regexSetLetter(re, inst->x))
+            re->prefix[re->prefixLen++] = regexSetLetter(re, inst->x);
+        else
+            break;
+    }
+}
+
+// record in longest the length of the path to instruction to, 0 if it loops back
+static int regexReach(int *longest, int pc, int to, int len)
+{
+    if (to <= pc)
+        return 0;
+
+    if (longest[to] < len)
+        longest[to] = len;
+
+    return 1;
+}
+
+/*
+* Without a jump backwards the program is a DAG walked in order, the longest
+* path to MATCH is the longest match. The Pike VM then starts no further than
+* that before the end of the first match the DFA found.
+*/
+static void regexComputeMaxLen(Regex *re)
+{
+    int *longest = malloc(re->count * sizeof(int));
+    int bounded = 1;
+
+    for (int pc = 0; pc < re->count; pc++)
+        longest[pc] = -1;
+
+    longest[0] = 0;
+    re->maxLen = 0;
+
+    for (int pc = 0; pc < re->count && bounded; pc++)
+    {
+        const RegexInst *inst = &re->program[pc];
+        int len = longest[pc];
+
+        if (len == -1)
+            continue;
+
+        switch (inst->op)
+        {
+        case REGEX_BYTE:
+        case REGEX_SET:
+            bounded = regexReach(longest, pc, pc + 1, len + 1);
+            break;
+        case REGEX_SPLIT:
+            bounded = regexReach(longest, pc, inst->x, len) && regexReach(longest, pc, inst->y, len);
+            break;
+        case REGEX_JMP:
+            bounded = regexReach(longest, pc, inst->x, len);
+            break;
+        case REGEX_BOL:
+        case REGEX_EOL:
+            bounded = regexReach(longest, pc, pc + 1, len);
+            break;
+        case REGEX_MATCH:
+            if (len > re->maxLen)
+                re->maxLen = len;
+            break;
+        }
+    }
+
+    if (!bounded)
+        re->maxLen = -1;
+
+    free(longest);
+}
+
+int regexCompile(Regex *re, const char *pattern, size_t len, int ignoreCase)
+{
+    RegexParser parser = {pattern, len, 0, 0, NULL, 0, 0, re};
+    int anySets[2];
+
+    re->program = malloc((REGEX_MAX_INSTRUCTIONS + 1) * sizeof(RegexInst));
+    re->count = 0;
+    re->sets = NULL;
+    re->setsCount = 0;
+    re->prefix = NULL;
+    re->ignoreCase = ignoreCase;
+    re->error = NULL;
+
+    anySets[0] = regexNewSet(re);
+    regexSetRange(re, anySets[0], 0, 255);
+    anySets[1] = regexNewSet(re);
+    regexSetRange(re, anySets[1], 0x80, 0xBF);
+
+    int root = regexParseAlt(&parser);
+
+    if (!re->error && parser.at < len)
+        re->error = "unmatched )";
+
+    if (!re->error)
+    {
+        regexCompileNode(re, parser.nodes, root, anySets);
+        regexEmit(re, REGEX_MATCH);
+    }
+
+    free(parser.nodes);
+
+    if (re->error)
+        return -1;
+
+    regexComputeClasses(re);
+    regexComputePrefix(re);
+    regexComputeMaxLen(re);
+
+    return 0;
+}
+
+void regexFree(Regex *re)
+{
+    free(re->program);
+    free(re->sets);
+    free(re->prefix);
+    re->program = NULL;
+    re->sets = NULL;
+    re->prefix = NULL;
+}
+
+static int regexInstMatches(const Regex *re, const RegexInst *inst, unsigned char c)
+{
+    return inst->op == REGEX_BYTE ? inst->byte == c : inst->op == REGEX_SET && regexSetHas(re, inst->x, c);
+}
+
+static unsigned regexNewMark(RegexMatcher *m)
+{
+    if (++m->mark == 0)
+    {
+        memset(m->marks, 0, m->re->count * sizeof(unsigned));
+        m->mark = 1;
+    }
+
+    return m->mark;
+}
+
+static int regexCompareInts(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+/*
+* Instructions reached from roots without consuming a byte : the ones waiting
+* for a byte, MATCH, and EOL unless at the end. Stored sorted into out.
+*/
+static int regexClosure(RegexMatcher *m, const int *roots, int rootsCount, int atStart, int atEnd, int *out)
+{
+    const RegexInst *program = m->re->program;
+    unsigned mark = regexNewMark(m);
+    int sp = 0;
+    int count = 0;
+
+    for (int i = 0; i < rootsCount; i++)
+        m->stack[sp++] = roots[i];
+
+    while (sp > 0)
+    {
+        int pc = m->stack[--sp];
+
+        if (m->marks[pc] == mark)
+            continue;
+
+        m->marks[pc] = mark;
+
+        switch (program[pc].op)
+        {
+        case REGEX_JMP:
+            m->stack[sp++] = program[pc].x;
+            break;
+        case REGEX_SPLIT:
+            m->stack[sp++] = program[pc].y;
+            m->stack[sp++] = program[pc].x;
+            break;
+        case REGEX_BOL:
+            if (atStart)
+                m->stack[sp++] = pc + 1;
+            break;
+        case REGEX_EOL:
+            if (atEnd)
+                m->stack[sp++] = pc + 1;
+            else
+                out[count++] = pc;
+            break;
+        default:
+            out[count++] = pc;
+            break;
+        }
+    }
+
+    qsort(out, count, sizeof(int), regexCompareInts);
+
+    return count;
+}
+
+static unsigned regexHashLeaves(const int *leaves, int count)
+{
+    unsigned hash = 2166136261u;
+
+    for (int i = 0; i < count; i++)
+        hash = (hash ^ leaves[i]) * 16777619u;
+
+    return hash;
+}
+
+static void regexDfaFlush(RegexMatcher *m)
+{
+    for (int i = 0; i < m->statesCount; i++)
+    {
+        free(m->states[i].leaves);
+    }
+
+    m->statesCount = 0;
+    m->memory = 0;
+    m->start[0] = m->start[1] = -1;
+
+    for (int i = 0; i < m->tableSize; i++)
+        m->table[i] = -1;
+}
+
+static void regexDfaGrowTable(RegexMatcher *m)
+{
+    m->tableSize *= 2;
+    m->table = realloc(m->table, m->tableSize * sizeof(int));
+
+    for (int i = 0; i < m->tableSize; i++)
+        m->table[i] = -1;
+
+    for (int i = 0; i < m->statesCount; i++)
+    {
+        unsigned bucket = m->states[i].hash & (m->tableSize - 1);
+
+        while (m->table[bucket] != -1)
+            bucket = (bucket + 1) & (m->tableSize - 1);
+
+        m->table[bucket] = i;
+    }
+}
+
+/*
+* The state of the given leaves, created if needed. Creating it may flush the
+* cache first, invalidating the other states : *flushed tells.
+*/
+static int regexDfaState(RegexMatcher *m, const int *leaves, int count, int *flushed)
+{
+    unsigned hash = regexHashLeaves(leaves, count);
+    unsigned bucket = hash & (m->tableSize - 1);
+
+    *flushed = 0;
+
+    for (; m->table[bucket] != -1; bucket = (bucket + 1) & (m->tableSize - 1))
+    {
+        RegexDfaState *state = &m->states[m->table[bucket]];
+
+        if (state->hash == hash && state->count == count && memcmp(state->leaves, leaves, count * sizeof(int)) == 0)
+            return m->table[bucket];
+    }
+
+    size_t size = sizeof(RegexDfaState) + (count + m->re->classesCount) * sizeof(int);
+
+    if (m->memory + size > REGEX_DFA_CACHE_BYTES && m->statesCount > 0)
+    {
+        regexDfaFlush(m);
+        *flushed = 1;
+        bucket = hash & (m->tableSize - 1);
+    }
+
+    if (m->statesCount == m->statesSize)
+    {
+        m->statesSize = m->statesSize ? m->statesSize * 2 : 64;
+        m->states = realloc(m->states, m->statesSize * sizeof(RegexDfaState));
+        m->transitions = realloc(m->transitions, m->statesSize * m->re->classesCount * sizeof(int));
+    }
+
+    int n = m->statesCount++;
+    RegexDfaState *state = &m->states[n];
+
+    state->leaves = malloc((count ? count : 1) * sizeof(int));
+    memcpy(state->leaves, leaves, count * sizeof(int));
+    state->count = count;
+    state->hash = hash;
+
+    for (int i = 0; i < m->re->classesCount; i++)
+        m->transitions[n * m->re->classesCount + i] = -1;
+
+    state->match = 0;
+    int roots = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (m->re->program[leaves[i]].op == REGEX_MATCH)
+            state->match = 1;
+        else if (m->re->program[leaves[i]].op == REGEX_EOL)
+            m->roots[roots++] = leaves[i] + 1;
+    }
+
+    // the EOL assertions hold if the text ends here
+    state->matchAtEnd = state->match;
+
+    if (!state->match && roots > 0)
+    {
+        int reached = regexClosure(m, m->roots, roots, 0, 1, m->threads[1]);
+
+        for (int i = 0; i < reached; i++)
+            if (m->re->program[m->threads[1][i]].op == REGEX_MATCH)
+                state->matchAtEnd = 1;
+    }
+
+    m->table[bucket] = n;
+    m->memory += size;
+
+    if (m->statesCount * 2 > m->tableSize)
+        regexDfaGrowTable(m);
+
+    return n;
+}
+
+// the state following s on byte c, computed and cached on first use
+static int regexDfaStep(RegexMatcher *m, int s, unsigned char c)
+{
+    const RegexDfaState *state = &m->states[s];
+    int roots = 0;
+
+    for (int i = 0; i < state->count; i++)
+        if (regexInstMatches(m->re, &m->re->program[state->leaves[i]], c))
+            m->roots[roots++] = state->leaves[i] + 1;
+
+    // a match may also start at the next byte
+    m->roots[roots++] = 0;
+
+    int count = regexClosure(m, m->roots, roots, 0, 0, m->leaves);
+    int flushed;
+    int next = regexDfaState(m, m->leaves, count, &flushed);
+
+    if (!flushed)
+        m->transitions[s * m->re->classesCount + m->re->classes[c]] = next;
+
+    return next;
+}
+
+// whether a match starts at or after from, and where the first one to end does
+static int regexDfaMatches(RegexMatcher *m, const char *text, size_t len, size_t from, size_t *firstEnd)
+{
+    int atStart = from == 0;
+    int flushed;
+    int s = m->start[atStart];
+
+    if (s == -1)
+    {
+        int root = 0;
+        int count = regexClosure(m, &root, 1, atStart, 0, m->leaves);
+        s = regexDfaState(m, m->leaves, count, &flushed);
+        m->start[atStart] = s;
+    }
+
+    const unsigned char *classes = m->re->classes;
+    int classesCount = m->re->classesCount;
+
+    for (size_t i = from; i < len; i++)
+    {
+        const RegexDfaState *state = &m->states[s];
+
+        if (state->match)
+        {
+            *firstEnd = i;
+            return 1;
+        }
+
+        // e.g. a pattern starting with ^ once past the start
+        if (state->count == 0)
+            return 0;
+
+        // a single load depends on the previous byte, the latency of the loop
+        int next = m->transitions[s * classesCount + classes[(unsigned char)text[i]]];
+        s = next != -1 ? next : regexDfaStep(m, s, text[i]);
+    }
+
+    *firstEnd = len;
+
+    return m->states[s].match || m->states[s].matchAtEnd;
+}
+
+static void regexAddThread(RegexMatcher *m, int *list, size_t *starts, int *count, unsigned mark,
+                           int pc, size_t start, size_t pos, size_t len)
+{
+    const RegexInst *program = m->re->program;
+    int sp = 0;
+
+    m->stack[sp++] = pc;
+
+    // depth first, x before y : the list stays ordered by priority
+    while (sp > 0)
+    {
+        pc = m->stack[--sp];
+
+        if (m->marks[pc] == mark)
+            continue;
+
+        m->marks[pc] = mark;
+
+        switch (program[pc].op)
+        {
+        case REGEX_JMP:
+            m->stack[sp++] = program[pc].x;
+            break;
+        case REGEX_SPLIT:
+            m->stack[sp++] = program[pc].y;
+            m->stack[sp++] = program[pc].x;
+            break;
+        case REGEX_BOL:
+            if (pos == 0)
+                m->stack[sp++] = pc + 1;
+            break;
+        case REGEX_EOL:
+            if (pos == len)
+                m->stack[sp++] = pc + 1;
+            break;
+        default:
+            list[*count] = pc;
+            starts[*count] = start;
+            (*count)++;
+            break;
+        }
+    }
+}
+
+// leftmost first match with the Pike VM : the NFA threads run in lockstep, by priority
+static int regexPike(RegexMatcher *m, const char *text, size_t len, size_t from, size_t *matchStart, size_t *matchEnd)
+{
+    int *list = m->threads[0];
+    size_t *starts = m->starts[0];
+    int *nextList = m->threads[1];
+    size_t *nextStarts = m->starts[1];
+    int count = 0;
+    unsigned mark = regexNewMark(m);
+    int matched = 0;
+
+    for (size_t pos = from;; pos++)
+    {
+        // a match starting here has the lowest priority
+        if (!matched)
+            regexAddThread(m, list, starts, &count, mark, 0, pos, pos, len);
+
+        if (count == 0 && matched)
+            break;
+
+        unsigned nextMark = regexNewMark(m);
+        int nextCount = 0;
+
+        for (int i = 0; i < count; i++)
+        {
+            const RegexInst *inst = &m->re->program[list[i]];
+
+            if (inst->op == REGEX_MATCH)
+            {
+                // the threads after this one have a lower priority
+                matched = 1;
+                *matchStart = starts[i];
+                *matchEnd = pos;
+                break;
+            }
+
+            if (pos < len && regexInstMatches(m->re, inst, text[pos]))
+                regexAddThread(m, nextList, nextStarts, &nextCount, nextMark, list[i] + 1, starts[i], pos + 1, len);
+        }
+
+        if (pos == len)
+            break;
+
+        int *swapList = list;
+        size_t *swapStarts = starts;
+        list = nextList;
+        starts = nextStarts;
+        nextList = swapList;
+        nextStarts = swapStarts;
+        count = nextCount;
+        mark = nextMark;
+    }
+
+    return matched;
+}
+
+void regexMatcherInit(RegexMatcher *m, const Regex *re)
+{
+    int count = re->count;
+
+    m->re = re;
+    m->states = NULL;
+    m->statesCount = 0;
+    m->statesSize = 0;
+    m->transitions = NULL;
+    m->tableSize = 256;
+    m->table = malloc(m->tableSize * sizeof(int));
+    m->memory = 0;
+    // every instruction pushes at most two others, above the roots
+    m->stack = malloc((3 * count + 2) * sizeof(int));
+    m->marks = calloc(count, sizeof(unsigned));
+    m->mark = 0;
+    m->roots = malloc((count + 1) * sizeof(int));
+    m->leaves = malloc((count + 1) * sizeof(int));
+
+    for (int i = 0; i < 2; i++)
+    {
+        m->threads[i] = malloc((count + 1) * sizeof(int));
+        m->starts[i] = malloc((count + 1) * sizeof(size_t));
+    }
+
+    regexDfaFlush(m);
+}
+
+void regexMatcherFree(RegexMatcher *m)
+{
+    regexDfaFlush(m);
+    free(m->states);
+    free(m->transitions);
+    free(m->table);
+    free(m->stack);
+    free(m->marks);
+    free(m->roots);
+    free(m->leaves);
+
+    for (int i = 0; i < 2; i++)
+    {
+        free(m->threads[i]);
+        free(m->starts[i]);
+    }
+}
+
+int regexSearch(RegexMatcher *m, const char *text, size_t len, size_t from, size_t *start, size_t *end)
+{
+    const Regex *re = m->re;
+
+    if (from > len || (re->anchored && from > 0))
+        return 0;
+
+    const char *(*find)(const char *, size_t, const char *, size_t) = re->ignoreCase ? searchFindIgnoreCase : searchFind;
+
+    if (re->anchored && !find(text, len < re->prefixLen ? len : re->prefixLen, re->prefix, re->prefixLen))
+        return 0;
+
+    // no match starts before the first occurrence of the prefix
+    if (re->prefixLen > 0 && !re->anchored)
+    {
+        const char *candidate = find(text + from, len - from, re->prefix, re->prefixLen);
+
+        if (!candidate)
+            return 0;
+
+        from = candidate - text;
+    }
+
+    size_t firstEnd = from;
+
+    // most rows have no match and are rejected by the DFA alone
+    if (from < len && !regexDfaMatches(m, text, len, from, &firstEnd))
+        return 0;
+
+    // no match ends before firstEnd, so none starts more than maxLen before it
+    if (re->maxLen != -1 && firstEnd - from > (size_t)re->maxLen)
+        from = firstEnd - re->maxLen;
+
+    return regexPike(m, text, len, from, start, end);
+}
@@ -0,0 +1,112 @@
+#ifndef REGEX_H
+#define REGEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// patterns compiling to more instructions are rejected
+#define REGEX_MAX_INSTRUCTIONS 4096
+// memory of the DFA states cached by a matcher before they are flushed
+#define REGEX_DFA_CACHE_BYTES (1 << 20)
+
+enum RegexOp
+{
+    REGEX_BYTE,  // consume byte
+    REGEX_SET,   // consume a byte of sets[x]
+    REGEX_SPLIT, // continue at x, then at y with a lower priority
+    REGEX_JMP,   // continue at x
+    REGEX_BOL,   // at the start of the text
+    REGEX_EOL,   // at the end of the text
+    REGEX_MATCH
+};
+
+typedef struct RegexInst
+{
+    unsigned char op;
+    unsigned char byte;
+    int x;
+    int y;
+} RegexInst;
+
+/*
+* A pattern compiled to a Thompson NFA program. Supported syntax : literals,
+* '.' (a UTF-8 char), classes of bytes such as [a-z] or [^0-9], \d \w \s
+* and their negations, ^ $, grouping with ( ) or (?: ), alternation | and
+* the repetitions * + ? {n} {n,} {n,m}, lazy when followed by '?'.
+* There are no back references : matching runs in linear time.
+*/
+typedef struct Regex
+{
+    RegexInst *program;
+    int count;
+    uint8_t (*sets)[32]; // bitmaps of 256 bytes
+    int setsCount;
+    // bytes the program does not tell apart share a class, the DFA moves by class
+    unsigned char classes[256];
+    int classesCount;
+    char *prefix; // bytes every match starts with, found with searchFind before running the DFA
+    size_t prefixLen;
+    int anchored; // the pattern starts with ^
+    int maxLen; // bytes of the longest match, -1 when unbounded
+    int ignoreCase; // ASCII letters match both cases, the prefix is searched for ignoring it
+    const char *error; // set when compiling failed
+} Regex;
+
+/*
+* Returns -1 if the pattern is invalid, with re->error describing why.
+* re must be freed either way.
+*/
+int regexCompile(Regex *re, const char *pattern, size_t len, int ignoreCase);
+
+void regexFree(Regex *re);
+
+typedef struct RegexDfaState
+{
+    int *leaves; // sorted instructions waiting for a byte, EOL or MATCH
+    int count;
+    int match;
+    int matchAtEnd;
+    unsigned hash;
+} RegexDfaState;
+
+/*
+* Matching state of a compiled regex, to be used by one thread at a time.
+* Text is first run through a DFA built lazily from the program, its states
+* being cached up to REGEX_DFA_CACHE_BYTES. Most rows are rejected there in a
+* single pass. The Pike VM then finds the bounds of the leftmost match of
+* the rows that have one.
+*/
+typedef struct RegexMatcher
+{
+    const Regex *re;
+
+    RegexDfaState *states;
+    int statesCount;
+    int statesSize;
+    int *transitions; // state reached from state s by class c at s * classesCount + c, -1 until computed
+    int *table;       // hash table of the states, -1 for empty buckets
+    int tableSize;
+    size_t memory;
+    int start[2]; // start state, when the text begins the row or not
+
+    // scratch for closures and the Pike VM threads
+    int *stack;
+    unsigned *marks; // instructions already visited by the closure marked mark
+    unsigned mark;
+    int *roots;
+    int *leaves;
+    int *threads[2];
+    size_t *starts[2];
+} RegexMatcher;
+
+void regexMatcherInit(RegexMatcher *matcher, const Regex *re);
+
+void regexMatcherFree(RegexMatcher *matcher);
+
+/*
+* Leftmost match of the regex in text starting at or after from. ^ only
+* matches at 0 and $ at len. Returns 1 and the match bounds if found.
+*/
+int regexSearch(RegexMatcher *matcher, const char *text, size_t len, size_t from, size_t *start, size_t *end);
+
+#endif
@@ -0,0 +1,249 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <regex.h>
+
+#include "regex.h"
+
+/*
+* Benchmark of the editor regex engine against POSIX regexec, run row by row
+* over a file the way the editor searches it :
+*
+*     make regexbench && ./regexbench [-i] file [pattern...]
+*
+* Every row is searched with both engines and the bounds of their first match
+* are compared. POSIX returns the longest of the leftmost matches where this
+* engine returns the first by priority, so patterns where alternatives or
+* lazy repetitions make the two differ report mismatches. The default patterns
+* agree. The exit status is 1 when a mismatch was found.
+*/
+
+#define BENCH_MAX_REPORTED 5
+
+static const char *DEFAULT_PATTERNS[] = {
+    "ERROR",
+    "error|warn",
+    "^[0-9]+-[0-9]+-[0-9]+",
+    "[0-9]+\\.[0-9]+\\.[0-9]+\\.[0-9]+",
+    "(GET|POST) /[a-z]+/[0-9]+",
+    "[A-Z][a-z]+Exception",
+    "time=[0-9]+ms$",
+    "x[a-z]*q[a-z]*z",
+};
+
+typedef struct BenchRows
+{
+    char *data;
+    char **text;
+    size_t *len;
+    int count;
+    size_t bytes;
+} BenchRows;
+
+typedef struct BenchMatch
+{
+    long start; // -1 when the row does not match
+    long end;
+} BenchMatch;
+
+static double monotonicMs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// split the file in rows as the editor does, without their \n or \r\n
+static int loadRows(const char *filename, BenchRows *rows)
+{
+    FILE *fp = fopen(filename, "r");
+
+    if (!fp)
+        return -1;
+
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    rewind(fp);
+
+    rows->data = malloc(size + 1);
+    rows->bytes = fread(rows->data, 1, size, fp);
+    rows->data[rows->bytes] = '\n';
+    fclose(fp);
+
+    rows->count = 0;
+
+    for (size_t i = 0; i < rows->bytes; i++)
+        rows->count += rows->data[i] == '\n';
+
+    rows->count += rows->bytes > 0 && rows->data[rows->bytes - 1] != '\n';
+    rows->text = malloc(rows->count * sizeof(char *));
+    rows->len = malloc(rows->count * sizeof(size_t));
+
+    char *start = rows->data;
+
+    for (int i = 0; i < rows->count; i++)
+    {
+        char *end = memchr(start, '\n', rows->data + rows->bytes + 1 - start);
+
+        rows->text[i] = start;
+        rows->len[i] = end > start && end[-1] == '\r' ? end - 1 - start : end - start;
+        start = end + 1;
+    }
+
+    return 0;
+}
+
+static double benchRegex(const BenchRows *rows, const char *pattern, int ignoreCase, BenchMatch *matches)
+{
+    Regex re;
+    RegexMatcher matcher;
+
+    if (regexCompile(&re, pattern, strlen(pattern), ignoreCase) == -1)
+    {
+        fprintf(stderr, "%s : %s\n", pattern, re.error);
+        regexFree(&re);
+        return -1;
+    }
+
+    regexMatcherInit(&matcher, &re);
+
+    double start = monotonicMs();
+
+    for (int i = 0; i < rows->count; i++)
+    {
+        size_t matchStart, matchEnd;
+
+        if (regexSearch(&matcher, rows->text[i], rows->len[i], 0, &matchStart, &matchEnd))
+            matches[i] = (BenchMatch){(long)matchStart, (long)matchEnd};
+        else
+            matches[i] = (BenchMatch){-1, -1};
+    }
+
+    double ms = monotonicMs() - start;
+
+    regexMatcherFree(&matcher);
+    regexFree(&re);
+
+    return ms;
+}
+
+static double benchRegexec(const BenchRows *rows, const char *pattern, int ignoreCase, BenchMatch *matches)
+{
+    regex_t re;
+
+    if (regcomp(&re, pattern, REG_EXTENDED | (ignoreCase ? REG_ICASE : 0)) != 0)
+    {
+        fprintf(stderr, "%s : rejected by regcomp\n", pattern);
+        return -1;
+    }
+
+    double start = monotonicMs();
+
+    for (int i = 0; i < rows->count; i++)
+    {
+        // rows are not NUL terminated, their bounds are given in the match
+        regmatch_t match = {0, (regoff_t)rows->len[i]};
+
+        if (regexec(&re, rows->text[i], 1, &match, REG_STARTEND) == 0)
+            matches[i] = (BenchMatch){(long)match.rm_so, (long)match.rm_eo};
+        else
+            matches[i] = (BenchMatch){-1, -1};
+    }
+
+    double ms = monotonicMs() - start;
+
+    regfree(&re);
+
+    return ms;
+}
+
+// number of rows whose matches differ, the first ones are printed
+static int compareMatches(const BenchRows *rows, const BenchMatch *ours, const BenchMatch *posix)
+{
+    int mismatches = 0;
+
+    for (int i = 0; i < rows->count; i++)
+    {
+        if (ours[i].start == posix[i].start && ours[i].end == posix[i].end)
+            continue;
+
+        if (mismatches++ < BENCH_MAX_REPORTED)
+            printf("    row %d : regex.c [%ld, %ld) regexec [%ld, %ld)\n",
+                   i + 1, ours[i].start, ours[i].end, posix[i].start, posix[i].end);
+    }
+
+    return mismatches;
+}
+
+int main(int argc, char *argv[])
+{
+    int ignoreCase = argc > 1 && strcmp(argv[1], "-i") == 0;
+    BenchRows rows;
+
+    if (argc < 2 + ignoreCase)
+    {
+        fprintf(stderr, "Usage : %s [-i] file [pattern...]\n", argv[0]);
+        return 2;
+    }
+
+    if (loadRows(argv[1 + ignoreCase], &rows) == -1)
+    {
+        perror(argv[1 + ignoreCase]);
+        return 2;
+    }
+
+    const char **patterns = (const char **)&argv[2 + ignoreCase];
+    int patternsCount = argc - 2 - ignoreCase;
+
+    if (patternsCount == 0)
+    {
+        patterns = DEFAULT_PATTERNS;
+        patternsCount = sizeof(DEFAULT_PATTERNS) / sizeof(DEFAULT_PATTERNS[0]);
+    }
+
+    BenchMatch *ours = malloc(rows.count * sizeof(BenchMatch));
+    BenchMatch *posix = malloc(rows.count * sizeof(BenchMatch));
+    int failed = 0;
+
+    printf("%d rows, %.1f MB%s\n", rows.count, rows.bytes / 1e6, ignoreCase ? ", ignoring case" : "");
+
+    for (int i = 0; i < patternsCount; i++)
+    {
+        double oursMs = benchRegex(&rows, patterns[i], ignoreCase, ours);
+        double posixMs = benchRegexec(&rows, patterns[i], ignoreCase, posix);
+
+        if (oursMs < 0 || posixMs < 0)
+        {
+            failed = 1;
+            continue;
+        }
+
+        int hits = 0;
+
+        for (int j = 0; j < rows.count; j++)
+            hits += ours[j].start != -1;
+
+        printf("%-36s %8d hits  regex.c %8.1f ms %7.1f MB/s  regexec %8.1f ms  x%.1f\n",
+               patterns[i], hits, oursMs, rows.bytes / oursMs / 1e3, posixMs, posixMs / oursMs);
+
+        int mismatches = compareMatches(&rows, ours, posix);
+
+        if (mismatches)
+        {
+            printf("    %d rows matched differently\n", mismatches);
+            failed = 1;
+        }
+    }
+
+    free(ours);
+    free(posix);
+    free(rows.text);
+    free(rows.len);
+    free(rows.data);
+
+    return failed;
+}
@@ -0,0 +1,552 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "screen.h"
+#include "utf8.h"
+
+// decimal representations of the numbers below are precomputed for escape sequences
+#define SCREEN_DECIMALS 1000
+#define SCREEN_COST_INFINITE 1000000
+
+static const ScreenCell BLANK_CELL = {{' '}, 1, 1, SCREEN_ATTR_NORMAL};
+
+static char decimalText[SCREEN_DECIMALS][3];
+static unsigned char decimalLen[SCREEN_DECIMALS];
+
+static void initDecimals()
+{
+    if (decimalLen[0] != 0)
+        return;
+
+    for (int n = 0; n < SCREEN_DECIMALS; n++)
+    {
+        char digits[3];
+        int len = 0;
+        int value = n;
+
+        do
+        {
+            digits[len++] = '0' + value % 10;
+            value /= 10;
+        } while (value);
+
+        for (int i = 0; i < len; i++)
+            decimalText[n][i] = digits[len - 1 - i];
+
+        decimalLen[n] = len;
+    }
+}
+
+static int decimalCost(int n)
+{
+    return n < SCREEN_DECIMALS ? decimalLen[n] : n < 10000 ? 4 : 10;
+}
+
+static void appendDecimal(StringBuffer *sb, int n)
+{
+    if (n < SCREEN_DECIMALS)
+    {
+        sbAppend(sb, decimalText[n], decimalLen[n]);
+        return;
+    }
+
+    sbAppendf(sb, "%d", n);
+}
+
+static int cellEquals(const ScreenCell *a, const ScreenCell *b)
+{
+    return a->len == b->len && a->width == b->width && a->attr == b->attr &&
+           memcmp(a->ch, b->ch, a->len) == 0;
+}
+
+static void blankCells(ScreenCell *cells, int count)
+{
+    for (int i = 0; i < count; i++)
+        cells[i] = BLANK_CELL;
+}
+
+void screenResize(Screen *screen, int rows, int cols)
+{
+    initDecimals();
+    screenFree(screen);
+
+    screen->rows = rows;
+    screen->cols = cols;
+    screen->front = malloc(sizeof(ScreenCell) * rows * cols);
+    screen->back = malloc(sizeof(ScreenCell) * rows * cols);
+
+    screenInvalidate(screen);
+    screenClear(screen);
+}
+
+void screenInvalidate(Screen *screen)
+{
+    screen->frontValid = 0;
+    screen->cursorKnown = 0;
+}
+
+void screenClear(Screen *screen)
+{
+    blankCells(screen->back, screen->rows * screen->cols);
+}
+
+// set a cell of a row, first breaking the wide char it may be half of
+static void setCell(ScreenCell *cells, int cols, int col, const char *ch, int len, int width, unsigned char attr)
+{
+    if (cells[col].len == 0 && col > 0)
+        cells[col - 1] = BLANK_CELL;
+
+    if (cells[col].width == 2 && col + 1 < cols)
+        cells[col + 1] = BLANK_CELL;
+
+    memcpy(cells[col].ch, ch, len);
+    cells[col].len = len;
+    cells[col].width = width;
+    cells[col].attr = attr;
+}
+
+int screenPut(Screen *screen, int row, int col, const char *s, int len, unsigned char attr)
+{
+    if (row < 0 || row >= screen->rows || col < 0)
+        return col;
+
+    ScreenCell *cells = &screen->back[row * screen->cols];
+    int i = 0;
+
+    while (i < len && col < screen->cols)
+    {
+        unsigned int codepoint;
+        int n = utf8Decode(&s[i], len - i, &codepoint);
+        const char *ch = &s[i];
+        char replacement[4];
+        int width;
+
+        i += n;
+
+        if (codepoint < 0x20 || codepoint == 0x7F)
+        {
+            ch = "?";
+            width = 1;
+        }
+        else if ((width = utf8Width(codepoint)) == 0)
+        {
+            ScreenCell *previous = col > 0 ? &cells[col - 1] : NULL;
+
+            if (previous && previous->len == 0 && col > 1)
+                previous = &cells[col - 2];
+
+            if (previous && previous->len && previous->len + n <= SCREEN_CELL_BYTES)
+            {
+                memcpy(&previous->ch[previous->len], ch, n);
+                previous->len += n;
+            }
+
+            continue;
+        }
+        else if (codepoint == UTF8_REPLACEMENT_CHAR && n == 1)
+        {
+            n = utf8Encode(UTF8_REPLACEMENT_CHAR, replacement);
+            ch = replacement;
+        }
+
+        // a wide char that does not fit in the last column is replaced by a space
+        if (width == 2 && col + 1 == screen->cols)
+        {
+            setCell(cells, screen->cols, col++, " ", 1, 1, attr);
+            break;
+        }
+
+        setCell(cells, screen->cols, col++, ch, n, width, attr);
+
+        if (width == 2)
+            setCell(cells, screen->cols, col++, "", 0, 0, attr);
+    }
+
+    return col;
+}
+
+void screenFill(Screen *screen, int row, int col, char c, int count, unsigned char attr)
+{
+    if (row < 0 || row >= screen->rows || col < 0)
+        return;
+
+    ScreenCell *cells = &screen->back[row * screen->cols];
+
+    for (; count > 0 && col < screen->cols; count--, col++)
+        setCell(cells, screen->cols, col, &c, 1, 1, attr);
+}
+
+void screenAddAttr(Screen *screen, int row, int col, int count, unsigned char attr)
+{
+    if (row < 0 || row >= screen->rows || col < 0)
+        return;
+
+    ScreenCell *cells = &screen->back[row * screen->cols];
+
+    for (; count > 0 && col < screen->cols; count--, col++)
+        cells[col].attr |= attr;
+}
+
+// cost of a CSI sequence with one numeric parameter, omitted when it is 1
+static int csiCost(int n)
+{
+    return n == 1 ? 3 : 3 + decimalCost(n);
+}
+
+static void appendCsi(StringBuffer *sb, int n, char command)
+{
+    sbAppend(sb, "\x1b[", 2);
+
+    if (n != 1)
+        appendDecimal(sb, n);
+
+    sbAppend(sb, &command, 1);
+}
+
+// cost of rewriting cells[from, to) to move the cursor, only possible
+// without changing the attributes and with single width chars
+static int reprintCost(const Screen *screen, const ScreenCell *cells, int from, int to)
+{
+    int cost = 0;
+
+    for (int col = from; col < to; col++)
+    {
+        if (cells[col].attr != screen->attr || cells[col].width != 1)
+            return SCREEN_COST_INFINITE;
+
+        cost += cells[col].len;
+    }
+
+    return cost;
+}
+
+enum HorizontalMove
+{
+    MOVE_NONE,
+    MOVE_RIGHT,
+    MOVE_LEFT,
+    MOVE_REPRINT,
+    MOVE_CR,
+    MOVE_CR_RIGHT,
+    MOVE_CR_REPRINT
+};
+
+/*
+* Move the cursor to (row, col) with the fewest bytes. Absolute positioning
+* (CUP) is always possible. When the cursor position is known we also consider
+* going down with LF or CUD, up with CUU, then left or right with CR, CUF, CUB
+* or by rewriting the cells of the target row (cells) already displayed.
+*/
+static void screenMoveCursor(Screen *screen, StringBuffer *sb, int row, int col, const ScreenCell *cells)
+{
+    if (screen->cursorKnown && screen->cursorRow == row && screen->cursorCol == col)
+        return;
+
+    int cupCost = 3 + (row ? decimalCost(row + 1) : 0) + (col ? 1 + decimalCost(col + 1) : 0);
+
+    if (screen->cursorKnown)
+    {
+        int down = row - screen->cursorRow;
+        int verticalCost = 0;
+
+        if (down > 0)
+            verticalCost = down < csiCost(down) ? down : csiCost(down);
+        else if (down < 0)
+            verticalCost = csiCost(-down);
+
+        int from = screen->cursorCol;
+        enum HorizontalMove move = MOVE_NONE;
+        int horizontalCost = 0;
+
+        if (col != from)
+        {
+            int cost;
+            horizontalCost = SCREEN_COST_INFINITE;
+
+            if (col > from)
+            {
+                move = MOVE_RIGHT;
+                horizontalCost = csiCost(col - from);
+
+                if ((cost = reprintCost(screen, cells, from, col)) < horizontalCost)
+                {
+                    move = MOVE_REPRINT;
+                    horizontalCost = cost;
+                }
+            }
+            else
+            {
+                move = MOVE_LEFT;
+                horizontalCost = csiCost(from - col);
+            }
+
+            if (col == 0)
+            {
+                move = MOVE_CR;
+                horizontalCost = 1;
+            }
+            else
+            {
+                if ((cost = 1 + csiCost(col)) < horizontalCost)
+                {
+                    move = MOVE_CR_RIGHT;
+                    horizontalCost = cost;
+                }
+
+                if ((cost = 1 + reprintCost(screen, cells, 0, col)) < horizontalCost)
+                {
+                    move = MOVE_CR_REPRINT;
+                    horizontalCost = cost;
+                }
+            }
+        }
+
+        if (verticalCost + horizontalCost < cupCost)
+        {
+            if (down > 0 && down < csiCost(down))
+                sbFill(sb, '\n', down);
+            else if (down > 0)
+                appendCsi(sb, down, 'B');
+            else if (down < 0)
+                appendCsi(sb, -down, 'A');
+
+            switch (move)
+            {
+            case MOVE_NONE:
+                break;
+            case MOVE_RIGHT:
+                appendCsi(sb, col - from, 'C');
+                break;
+            case MOVE_LEFT:
+                appendCsi(sb, from - col, 'D');
+                break;
+            case MOVE_REPRINT:
+                for (int i = from; i < col; i++)
+                    sbAppend(sb, cells[i].ch, cells[i].len);
+                break;
+            case MOVE_CR:
+                sbAppend(sb, "\r", 1);
+                break;
+            case MOVE_CR_RIGHT:
+                sbAppend(sb, "\r", 1);
+                appendCsi(sb, col, 'C');
+                break;
+            case MOVE_CR_REPRINT:
+                sbAppend(sb, "\r", 1);
+                for (int i = 0; i < col; i++)
+                    sbAppend(sb, cells[i].ch, cells[i].len);
+                break;
+            }
+
+            screen->cursorRow = row;
+            screen->cursorCol = col;
+
+            return;
+        }
+    }
+
+    sbAppend(sb, "\x1b[", 2);
+
+    if (row)
+        appendDecimal(sb, row + 1);
+
+    if (col)
+    {
+        sbAppend(sb, ";", 1);
+        appendDecimal(sb, col + 1);
+    }
+
+    sbAppend(sb, "H", 1);
+
+    screen->cursorRow = row;
+    screen->cursorCol = col;
+    screen->cursorKnown = 1;
+}
+
+// append a parameter to the SGR sequence in buf
+static int sgrParam(char *buf, int len, const char *param)
+{
+    if (buf[len - 1] != '[')
+        buf[len++] = ';';
+
+    memcpy(&buf[len], param, strlen(param));
+
+    return len + strlen(param);
+}
+
+static void screenSetAttr(Screen *screen, StringBuffer *sb, unsigned char attr)
+{
+    if (screen->attr == attr)
+        return;
+
+    char buf[32] = "\x1b[";
+    int len = 2;
+    unsigned char added = attr & ~screen->attr;
+
+    // attributes are reset only when some of the current ones must go
+    if (screen->attr & ~attr)
+    {
+        len = sgrParam(buf, len, "0");
+        added = attr;
+    }
+
+    if (added & SCREEN_ATTR_BOLD)
+        len = sgrParam(buf, len, "1");
+
+    if (added & SCREEN_ATTR_BLINK)
+        len = sgrParam(buf, len, "5");
+
+    if (added & SCREEN_ATTR_REVERSE)
+        len = sgrParam(buf, len, "7");
+
+    if (added & SCREEN_ATTR_MATCH)
+        len = sgrParam(buf, len, "30;43");
+
+    buf[len++] = 'm';
+    sbAppend(sb, buf, len);
+
+    screen->attr = attr;
+}
+
+static void screenPutCell(Screen *screen, StringBuffer *sb, const ScreenCell *cell)
+{
+    screenSetAttr(screen, sb, cell->attr);
+    sbAppend(sb, cell->ch, cell->len);
+
+    // writing the last column leaves the cursor in a pending wrap state
+    // that terminals handle differently, so forget where it is
+    screen->cursorCol += cell->width;
+
+    if (screen->cursorCol >= screen->cols)
+        screen->cursorKnown = 0;
+}
+
+/*
+* Emit the changed spans of one row. The cursor is moved over runs of
+* unchanged cells, which may rewrite them when it is the cheapest move.
+* When the end of the row becomes blank it is erased with EL instead of written.
+*/
+static void screenRenderRow(Screen *screen, StringBuffer *sb, int row)
+{
+    const ScreenCell *front = &screen->front[row * screen->cols];
+    const ScreenCell *back = &screen->back[row * screen->cols];
+
+    int first = 0;
+    int last = screen->cols - 1;
+
+    while (first < screen->cols && cellEquals(&front[first], &back[first]))
+        first++;
+
+    if (first == screen->cols)
+        return;
+
+    while (cellEquals(&front[last], &back[last]))
+        last--;
+
+    // start of the blank tail of the new row
+    int blankFrom = screen->cols;
+
+    while (blankFrom > first && cellEquals(&back[blankFrom - 1], &BLANK_CELL))
+        blankFrom--;
+
+    int end = blankFrom <= last ? blankFrom : last + 1;
+    int col = first;
+
+    while (col < end)
+    {
+        while (col < end && cellEquals(&front[col], &back[col]))
+            col++;
+
+        if (col == end)
+            break;
+
+        // a changed right half of a wide char is drawn with its left half
+        if (back[col].len == 0)
+            col--;
+
+        screenMoveCursor(screen, sb, row, col, back);
+
+        do
+        {
+            screenPutCell(screen, sb, &back[col]);
+            col += back[col].width ? back[col].width : 1;
+        } while (col < end && !cellEquals(&front[col], &back[col]));
+    }
+
+    if (end == blankFrom && end <= last)
+    {
+        screenMoveCursor(screen, sb, row, end, back);
+        screenSetAttr(screen, sb, SCREEN_ATTR_NORMAL);
+        sbAppend(sb, "\x1b[K", 3);
+    }
+}
+
+void screenScroll(Screen *screen, StringBuffer *sb, int top, int bottom, int count)
+{
+    int height = bottom - top + 1;
+
+    if (!screen->frontValid || count == 0 || count >= height || -count >= height)
+        return;
+
+    // the scrolled in rows are blanked with the current attributes
+    if (screen->attr != SCREEN_ATTR_NORMAL)
+        screenSetAttr(screen, sb, SCREEN_ATTR_NORMAL);
+
+    sbAppend(sb, "\x1b[", 2);
+    appendDecimal(sb, top + 1);
+    sbAppend(sb, ";", 1);
+    appendDecimal(sb, bottom + 1);
+    sbAppend(sb, "r", 1);
+    appendCsi(sb, count > 0 ? count : -count, count > 0 ? 'S' : 'T');
+    sbAppend(sb, "\x1b[r", 3);
+
+    // setting the scrolling region homes the cursor
+    screen->cursorRow = 0;
+    screen->cursorCol = 0;
+    screen->cursorKnown = 1;
+
+    size_t rowSize = sizeof(ScreenCell) * screen->cols;
+    ScreenCell *region = &screen->front[top * screen->cols];
+
+    if (count > 0)
+    {
+        memmove(region, &region[count * screen->cols], rowSize * (height - count));
+        blankCells(&region[(height - count) * screen->cols], count * screen->cols);
+    }
+    else
+    {
+        count = -count;
+        memmove(&region[count * screen->cols], region, rowSize * (height - count));
+        blankCells(region, count * screen->cols);
+    }
+}
+
+void screenRender(Screen *screen, StringBuffer *sb, int cursorRow, int cursorCol)
+{
+    if (!screen->frontValid)
+    {
+        sbAppend(sb, "\x1b[m\x1b[2J", 7);
+        blankCells(screen->front, screen->rows * screen->cols);
+        screen->frontValid = 1;
+        screen->attr = SCREEN_ATTR_NORMAL;
+    }
+
+    for (int row = 0; row < screen->rows; row++)
+        screenRenderRow(screen, sb, row);
+
+    screenSetAttr(screen, sb, SCREEN_ATTR_NORMAL);
+    screenMoveCursor(screen, sb, cursorRow, cursorCol, &screen->back[cursorRow * screen->cols]);
+
+    ScreenCell *swap = screen->front;
+    screen->front = screen->back;
+    screen->back = swap;
+}
+
+void screenFree(Screen *screen)
+{
+    free(screen->front);
+    free(screen->back);
+
+    screen->front = NULL;
+    screen->back = NULL;
+}
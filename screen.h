@@ -0,0 +1,101 @@
+#ifndef SCREEN_H
+#define SCREEN_H
+
+#include "stringbuffer.h"
+
+#define SCREEN_ATTR_NORMAL 0
+#define SCREEN_ATTR_BOLD 1
+#define SCREEN_ATTR_BLINK 2
+#define SCREEN_ATTR_REVERSE 4
+#define SCREEN_ATTR_MATCH 8 // search hits, black on yellow
+
+// room for a char and a couple of combining marks
+#define SCREEN_CELL_BYTES 8
+
+/*
+* One column of the screen. A wide char takes two cells : the first holds
+* the char with width 2, the second is a continuation cell with len 0.
+*/
+typedef struct ScreenCell
+{
+    char ch[SCREEN_CELL_BYTES]; // UTF-8 sequence, not NUL terminated
+    unsigned char len;
+    unsigned char width;
+    unsigned char attr;
+} ScreenCell;
+
+/*
+* Two grids of cells : front holds what the terminal currently displays and
+* back the frame being composed. Rendering a frame only emits the cells that
+* differ between the two, then back becomes the new front.
+*/
+typedef struct Screen
+{
+    int rows;
+    int cols;
+    ScreenCell *front;
+    ScreenCell *back;
+    int frontValid;
+    // terminal state while rendering, used to pick the cheapest cursor moves
+    int cursorRow;
+    int cursorCol;
+    int cursorKnown;
+    unsigned char attr;
+} Screen;
+
+#define SCREEN_INIT                                          \
+    {                                                        \
+        0, 0, NULL, NULL, 0, 0, 0, 0, SCREEN_ATTR_NORMAL \
+    }
+
+/*
+* (Re)allocate both grids. The next frame will be a full repaint.
+*/
+void screenResize(Screen *screen, int rows, int cols);
+
+/*
+* Forget what the terminal displays so that the next frame is a full repaint.
+*/
+void screenInvalidate(Screen *screen);
+
+/*
+* Blank the back grid before composing a new frame.
+*/
+void screenClear(Screen *screen);
+
+/*
+* Put the len bytes of UTF-8 text s at the given position of the back grid,
+* clipped to the right edge of the screen. Wide chars take two columns and
+* combining marks join the previous cell. Invalid sequences are shown as
+* U+FFFD and control chars as '?'. Returns the column following the last char put.
+*/
+int screenPut(Screen *screen, int row, int col, const char *s, int len, unsigned char attr);
+
+/*
+* Fill count cells of the back grid with c starting at the given position.
+*/
+void screenFill(Screen *screen, int row, int col, char c, int count, unsigned char attr);
+
+/*
+* Add attr to count cells of the back grid starting at the given position,
+* e.g. to highlight text already put.
+*/
+void screenAddAttr(Screen *screen, int row, int col, int count, unsigned char attr);
+
+/*
+* Scroll rows top to bottom (inclusive) of the terminal by count lines using a
+* scrolling region (DECSTBM) : up with SU when count > 0, down with SD when
+* count < 0. The front grid is shifted the same way so that the next render
+* only draws the newly exposed rows. Does nothing if the front grid is not valid.
+*/
+void screenScroll(Screen *screen, StringBuffer *sb, int top, int bottom, int count);
+
+/*
+* Append to sb the escape sequences turning the front grid into the back grid
+* and leave the cursor at (cursorRow, cursorCol). The back grid becomes the front.
+*/
+void screenRender(Screen *screen, StringBuffer *sb, int cursorRow, int cursorCol);
+
+void screenFree(Screen *screen);
+
+#endif
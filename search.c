@@ -0,0 +1,170 @@
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "search.h"
+
+#define SEARCH_IS_UPPER(c) ((c) >= 'A' && (c) <= 'Z')
+#define SEARCH_IS_LETTER(c) (SEARCH_IS_UPPER(c) || ((c) >= 'a' && (c) <= 'z'))
+
+static unsigned char searchFold(unsigned char c)
+{
+    return SEARCH_IS_UPPER(c) ? c | 0x20 : c;
+}
+
+// the first and last bytes already matched
+static int searchVerify(const char *candidate, const char *needle, size_t needleLen, int ignoreCase)
+{
+    if (!ignoreCase)
+        return memcmp(candidate + 1, needle + 1, needleLen - 2) == 0;
+
+    for (size_t i = 1; i + 1 < needleLen; i++)
+        if (searchFold(candidate[i]) != searchFold(needle[i]))
+            return 0;
+
+    return 1;
+}
+
+#if defined(__SSE2__) || defined(__ARM_NEON)
+// first verified candidate of a block, given as a mask of positions
+static const char *searchMask(const char *block, uint64_t mask, int bitsPerPosition,
+                              const char *needle, size_t needleLen, int ignoreCase)
+{
+    while (mask)
+    {
+        int bit = __builtin_ctzll(mask);
+        const char *candidate = &block[bit / bitsPerPosition];
+
+        if (searchVerify(candidate, needle, needleLen, ignoreCase))
+            return candidate;
+
+        // clear all the bits of the position
+        mask &= ~((((uint64_t)1 << bitsPerPosition) - 1) << (bit - bit % bitsPerPosition));
+    }
+
+    return NULL;
+}
+#endif
+
+#if defined(__SSE2__)
+// bit i is set if block[i] and block[i + last] match the first and last bytes, once folded
+static uint64_t searchCandidates(const char *block, size_t last, __m128i first, __m128i lastByte,
+                                 __m128i firstFold, __m128i lastFold)
+{
+    __m128i starts = _mm_cmpeq_epi8(_mm_or_si128(_mm_loadu_si128((const __m128i *)block), firstFold), first);
+    __m128i ends = _mm_cmpeq_epi8(_mm_or_si128(_mm_loadu_si128((const __m128i *)&block[last]), lastFold), lastByte);
+
+    return (unsigned)_mm_movemask_epi8(_mm_and_si128(starts, ends));
+}
+#endif
+
+/*
+* With ignoreCase, the needle bytes that are letters are compared with bit
+* 0x20 set on both sides : only the two cases of the letter match it.
+* Called with a constant ignoreCase, the compiler specializes each path.
+*/
+static const char *searchScan(const char *haystack, size_t len, const char *needle, size_t needleLen,
+                              int ignoreCase)
+{
+    if (needleLen == 0)
+        return haystack;
+
+    if (needleLen > len)
+        return NULL;
+
+    if (needleLen == 1 && !ignoreCase)
+        return memchr(haystack, needle[0], len);
+
+    const size_t last = needleLen - 1;
+    // a match starts before end
+    const size_t end = len - last;
+    const unsigned char firstFold = ignoreCase && SEARCH_IS_LETTER(needle[0]) ? 0x20 : 0;
+    const unsigned char lastFold = ignoreCase && SEARCH_IS_LETTER(needle[last]) ? 0x20 : 0;
+    const unsigned char firstByte = needle[0] | firstFold;
+    const unsigned char lastByte = needle[last] | lastFold;
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const char *match;
+    const __m128i first = _mm_set1_epi8(firstByte);
+    const __m128i lastBytes = _mm_set1_epi8(lastByte);
+    const __m128i firstFolds = _mm_set1_epi8(firstFold);
+    const __m128i lastFolds = _mm_set1_epi8(lastFold);
+
+    for (; i + 32 <= end; i += 32)
+    {
+        uint64_t mask = searchCandidates(&haystack[i], last, first, lastBytes, firstFolds, lastFolds) |
+                        searchCandidates(&haystack[i + 16], last, first, lastBytes, firstFolds, lastFolds) << 16;
+
+        if (mask && (match = searchMask(&haystack[i], mask, 1, needle, needleLen, ignoreCase)))
+            return match;
+    }
+
+    for (; i + 16 <= end; i += 16)
+    {
+        uint64_t mask = searchCandidates(&haystack[i], last, first, lastBytes, firstFolds, lastFolds);
+
+        if (mask && (match = searchMask(&haystack[i], mask, 1, needle, needleLen, ignoreCase)))
+            return match;
+    }
+#elif defined(__ARM_NEON)
+    const char *match;
+    const uint8x16_t first = vdupq_n_u8(firstByte);
+    const uint8x16_t lastBytes = vdupq_n_u8(lastByte);
+    const uint8x16_t firstFolds = vdupq_n_u8(firstFold);
+    const uint8x16_t lastFolds = vdupq_n_u8(lastFold);
+
+    for (; i + 16 <= end; i += 16)
+    {
+        uint8x16_t starts = vceqq_u8(vorrq_u8(vld1q_u8((const uint8_t *)&haystack[i]), firstFolds), first);
+        uint8x16_t ends = vceqq_u8(vorrq_u8(vld1q_u8((const uint8_t *)&haystack[i + last]), lastFolds), lastBytes);
+        // NEON has no movemask : narrow each byte of the comparison to a nibble
+        uint16x8_t both = vreinterpretq_u16_u8(vandq_u8(starts, ends));
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(both, 4)), 0);
+
+        if (mask && (match = searchMask(&haystack[i], mask, 4, needle, needleLen, ignoreCase)))
+            return match;
+    }
+#endif
+
+    // short rows and the tail of long ones : memchr finds the candidates, it cannot fold
+    while (i < end && ignoreCase)
+    {
+        if (((unsigned char)haystack[i] | firstFold) == firstByte &&
+            ((unsigned char)haystack[i + last] | lastFold) == lastByte &&
+            searchVerify(&haystack[i], needle, needleLen, ignoreCase))
+            return &haystack[i];
+
+        i++;
+    }
+
+    while (i < end)
+    {
+        const char *candidate = memchr(&haystack[i], needle[0], end - i);
+
+        if (!candidate)
+            return NULL;
+
+        if (candidate[last] == needle[last] && searchVerify(candidate, needle, needleLen, ignoreCase))
+            return candidate;
+
+        i = candidate - haystack + 1;
+    }
+
+    return NULL;
+}
+
+const char *searchFind(const char *haystack, size_t len, const char *needle, size_t needleLen)
+{
+    return searchScan(haystack, len, needle, needleLen, 0);
+}
+
+const char *searchFindIgnoreCase(const char *haystack, size_t len, const char *needle, size_t needleLen)
+{
+    return searchScan(haystack, len, needle, needleLen, 1);
+}
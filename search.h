@@ -0,0 +1,22 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stddef.h>
+
+/*
+* First occurrence of the needleLen bytes of needle in the len bytes of
+* haystack, or NULL. Both may hold NUL bytes.
+* Candidates are filtered 16 or 32 positions at a time (SSE2 or NEON when
+* available) by comparing the first and the last byte of the needle, only
+* the positions where both match are verified with memcmp.
+*/
+const char *searchFind(const char *haystack, size_t len, const char *needle, size_t needleLen);
+
+/*
+* searchFind ignoring the case of ASCII letters. The filter folds the bytes
+* of the haystack in the SIMD registers, setting bit 0x20 where the needle
+* has a letter : rows are not copied nor lowercased.
+*/
+const char *searchFindIgnoreCase(const char *haystack, size_t len, const char *needle, size_t needleLen);
+
+#endif
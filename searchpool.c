@@ -0,0 +1,412 @@
+#define _GNU_SOURCE
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+
+#include "searchpool.h"
+#include "search.h"
+
+static void searchPoolSignal(SearchPool *pool)
+{
+    uint64_t one = 1;
+    write(pool->doneFd, &one, sizeof(one));
+}
+
+// lower firstHit to chunk unless an earlier chunk already has a hit
+static void searchPoolHit(SearchPool *pool, int chunk)
+{
+    int first = __atomic_load_n(&pool->firstHit, __ATOMIC_RELAXED);
+
+    while (chunk < first &&
+           !__atomic_compare_exchange_n(&pool->firstHit, &first, chunk, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+// count rows of block as scanned by the current search, the block is valid once all were
+static void searchCacheScanned(SearchCache *cache, int block, int rows)
+{
+    int blockRows = block == cache->blocksCount - 1 ? cache->rowsCount - block * SEARCH_CHUNK_ROWS : SEARCH_CHUNK_ROWS;
+
+    if (__atomic_add_fetch(&cache->blockScanned[block], rows, __ATOMIC_RELAXED) == blockRows)
+        __atomic_store_n(&cache->blockValid[block], 1, __ATOMIC_RELAXED);
+}
+
+static void searchPoolPublish(SearchPool *pool, int chunk)
+{
+    SearchChunk *result = &pool->chunks[chunk];
+
+    __atomic_store_n(&result->done, 1, __ATOMIC_RELEASE);
+
+    if (result->row != -1)
+    {
+        searchPoolHit(pool, chunk);
+        searchPoolSignal(pool);
+    }
+}
+
+static void searchPoolScanChunk(SearchPool *pool, int chunk)
+{
+    SearchChunk *result = &pool->chunks[chunk];
+    SearchCache *cache = &pool->cache;
+    int from = chunk * SEARCH_CHUNK_ROWS;
+    int to = from + SEARCH_CHUNK_ROWS < pool->rowsCount ? from + SEARCH_CHUNK_ROWS : pool->rowsCount;
+    int at = ((pool->start + (long)pool->direction * from) % pool->rowsCount + pool->rowsCount) % pool->rowsCount;
+    // rows scanned in the current block, counted once the chunk leaves it
+    int block = at / SEARCH_CHUNK_ROWS;
+    int blockValid = __atomic_load_n(&cache->blockValid[block], __ATOMIC_RELAXED);
+    int scanned = 0;
+
+    result->row = -1;
+
+    for (int i = from; i < to; i++, at += pool->direction)
+    {
+        if (__atomic_load_n(&pool->cancel, __ATOMIC_RELAXED))
+            return;
+
+        if (at == pool->rowsCount)
+            at = 0;
+        else if (at == -1)
+            at = pool->rowsCount - 1;
+
+        if (at / SEARCH_CHUNK_ROWS != block)
+        {
+            searchCacheScanned(cache, block, scanned);
+            block = at / SEARCH_CHUNK_ROWS;
+            blockValid = __atomic_load_n(&cache->blockValid[block], __ATOMIC_RELAXED);
+            scanned = 0;
+        }
+
+        scanned++;
+
+        uint64_t bit = (uint64_t)1 << (at % 64);
+        uint64_t word = __atomic_load_n(&cache->matches[at / 64], __ATOMIC_RELAXED);
+
+        // it did not match a prefix of the query
+        if (blockValid && !(word & bit))
+        {
+            // nor did the next rows of the word, skip them at once
+            if (!word)
+            {
+                int skip = pool->direction > 0 ? 63 - at % 64 : at % 64;
+
+                if (pool->direction > 0 && skip > pool->rowsCount - 1 - at)
+                    skip = pool->rowsCount - 1 - at;
+
+                if (skip > to - i - 1)
+                    skip = to - i - 1;
+
+                i += skip;
+                at += pool->direction * skip;
+                scanned += skip;
+            }
+
+            continue;
+        }
+
+        if (__atomic_load_n(&cache->blockQueryLen[block], __ATOMIC_RELAXED) < pool->queryLen)
+            __atomic_store_n(&cache->blockQueryLen[block], pool->queryLen, __ATOMIC_RELAXED);
+
+        size_t len;
+        const char *text = pool->rowText(at, &len);
+        const char *match = pool->flags & SEARCH_IGNORE_CASE ? searchFindIgnoreCase(text, len, pool->query, pool->queryLen)
+                                                              : searchFind(text, len, pool->query, pool->queryLen);
+
+        if (!match)
+        {
+            __atomic_fetch_and(&cache->matches[at / 64], ~bit, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        __atomic_fetch_or(&cache->matches[at / 64], bit, __ATOMIC_RELAXED);
+
+        result->row = at;
+        result->col = match - text;
+        break;
+    }
+
+    searchCacheScanned(cache, block, scanned);
+    searchPoolPublish(pool, chunk);
+}
+
+// the regex counterpart of searchPoolScanChunk, without the cache
+static void searchPoolScanChunkRegex(SearchWorker *worker, int chunk)
+{
+    SearchPool *pool = worker->pool;
+    SearchChunk *result = &pool->chunks[chunk];
+    int from = chunk * SEARCH_CHUNK_ROWS;
+    int to = from + SEARCH_CHUNK_ROWS < pool->rowsCount ? from + SEARCH_CHUNK_ROWS : pool->rowsCount;
+    int at = ((pool->start + (long)pool->direction * from) % pool->rowsCount + pool->rowsCount) % pool->rowsCount;
+
+    result->row = -1;
+
+    for (int i = from; i < to; i++, at += pool->direction)
+    {
+        if (__atomic_load_n(&pool->cancel, __ATOMIC_RELAXED))
+            return;
+
+        if (at == pool->rowsCount)
+            at = 0;
+        else if (at == -1)
+            at = pool->rowsCount - 1;
+
+        size_t len, start, end;
+        const char *text = pool->rowText(at, &len);
+
+        if (regexSearch(&worker->matcher, text, len, 0, &start, &end))
+        {
+            result->row = at;
+            result->col = start;
+            break;
+        }
+    }
+
+    searchPoolPublish(pool, chunk);
+}
+
+/*
+* Called between two searches : keep the blocks whose bits are still a
+* superset of the rows matching the new query.
+*/
+static void searchCacheUpdate(SearchCache *cache, int rowsCount, unsigned long version,
+                              const char *query, size_t queryLen, int flags)
+{
+    size_t common = 0;
+
+    if (rowsCount != cache->rowsCount || version != cache->version)
+    {
+        cache->rowsCount = rowsCount;
+        cache->version = version;
+        cache->blocksCount = (rowsCount + SEARCH_CHUNK_ROWS - 1) / SEARCH_CHUNK_ROWS;
+        cache->matches = realloc(cache->matches, ((rowsCount + 63) / 64 + 1) * sizeof(uint64_t));
+        cache->blockValid = realloc(cache->blockValid, cache->blocksCount + 1);
+        cache->blockQueryLen = realloc(cache->blockQueryLen, (cache->blocksCount + 1) * sizeof(size_t));
+        cache->blockScanned = realloc(cache->blockScanned, (cache->blocksCount + 1) * sizeof(int));
+        memset(cache->blockValid, 0, cache->blocksCount);
+    }
+    else if (flags == cache->flags)
+    {
+        while (common < queryLen && common < cache->queryLen && query[common] == cache->query[common])
+            common++;
+    }
+
+    for (int i = 0; i < cache->blocksCount; i++)
+    {
+        if (!cache->blockValid[i] || cache->blockQueryLen[i] > common)
+        {
+            cache->blockValid[i] = 0;
+            cache->blockQueryLen[i] = 0;
+        }
+
+        cache->blockScanned[i] = 0;
+    }
+
+    cache->query = realloc(cache->query, queryLen + 1);
+    memcpy(cache->query, query, queryLen);
+    cache->queryLen = queryLen;
+    cache->flags = flags;
+}
+
+static void *searchPoolWorker(void *arg)
+{
+    SearchWorker *worker = arg;
+    SearchPool *pool = worker->pool;
+    unsigned seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+
+    while (1)
+    {
+        while (pool->generation == seen)
+            pthread_cond_wait(&pool->wake, &pool->lock);
+
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        int regex = pool->flags & SEARCH_REGEX;
+
+        // the previous regex was freed by now, only its matcher is left
+        if (regex && worker->regexVersion != pool->regexVersion)
+        {
+            if (worker->regexVersion)
+                regexMatcherFree(&worker->matcher);
+
+            regexMatcherInit(&worker->matcher, &pool->regex);
+            worker->regexVersion = pool->regexVersion;
+        }
+
+        int chunk;
+
+        // chunks are claimed in scan order, once one is past the first hit so are the next ones
+        while (!__atomic_load_n(&pool->cancel, __ATOMIC_RELAXED) &&
+               (chunk = __atomic_fetch_add(&pool->nextChunk, 1, __ATOMIC_RELAXED)) < pool->chunksCount &&
+               chunk < __atomic_load_n(&pool->firstHit, __ATOMIC_RELAXED))
+        {
+            if (regex)
+                searchPoolScanChunkRegex(worker, chunk);
+            else
+                searchPoolScanChunk(pool, chunk);
+        }
+
+        pthread_mutex_lock(&pool->lock);
+
+        if (--pool->active == 0)
+        {
+            pthread_cond_broadcast(&pool->idle);
+            searchPoolSignal(pool);
+        }
+    }
+
+    return NULL;
+}
+
+int searchPoolInit(SearchPool *pool)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    pool->workersCount = cpus < 1 ? 1 : cpus > SEARCH_MAX_WORKERS ? SEARCH_MAX_WORKERS : cpus;
+    pool->generation = 0;
+    pool->active = 0;
+    pool->query = NULL;
+    pool->queryLen = 0;
+    pool->flags = 0;
+    pool->regexCompiled = 0;
+    pool->regexVersion = 0;
+    pool->chunks = NULL;
+    pool->chunksSize = 0;
+    pool->chunksCount = 0;
+    pool->cache.matches = NULL;
+    pool->cache.rowsCount = -1;
+    pool->cache.query = NULL;
+    pool->cache.queryLen = 0;
+    pool->cache.flags = 0;
+    pool->cache.blocksCount = 0;
+    pool->cache.blockValid = NULL;
+    pool->cache.blockQueryLen = NULL;
+    pool->cache.blockScanned = NULL;
+    pool->doneFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (pool->doneFd == -1 ||
+        pthread_mutex_init(&pool->lock, NULL) != 0 ||
+        pthread_cond_init(&pool->wake, NULL) != 0 ||
+        pthread_cond_init(&pool->idle, NULL) != 0)
+        return -1;
+
+    for (int i = 0; i < pool->workersCount; i++)
+    {
+        pool->workers[i].pool = pool;
+        pool->workers[i].regexVersion = 0;
+
+        if (pthread_create(&pool->workers[i].thread, NULL, searchPoolWorker, &pool->workers[i]) != 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+// compile query unless it is the pattern of the current regex, the workers must be idle
+static int searchPoolCompile(SearchPool *pool, const char *query, size_t queryLen, int flags)
+{
+    if (pool->regexCompiled && flags == pool->flags && queryLen == pool->queryLen &&
+        memcmp(query, pool->query, queryLen) == 0)
+        return pool->regex.error ? -1 : 0;
+
+    if (pool->regexCompiled)
+        regexFree(&pool->regex);
+
+    pool->regexCompiled = 1;
+    pool->regexVersion++;
+
+    return regexCompile(&pool->regex, query, queryLen, flags & SEARCH_IGNORE_CASE);
+}
+
+int searchPoolStart(SearchPool *pool, SearchRowText rowText, int rowsCount, unsigned long version,
+                    int start, int direction, const char *query, size_t queryLen, int flags)
+{
+    searchPoolCancel(pool);
+
+    int invalid = (flags & SEARCH_REGEX) && searchPoolCompile(pool, query, queryLen, flags) == -1;
+
+    if (!(flags & SEARCH_REGEX))
+        searchCacheUpdate(&pool->cache, rowsCount, version, query, queryLen, flags);
+
+    pool->flags = flags;
+    pool->queryLen = queryLen;
+    pool->query = realloc(pool->query, queryLen + 1);
+    memcpy(pool->query, query, queryLen);
+
+    if (invalid)
+        return -1;
+
+    pool->rowText = rowText;
+    pool->rowsCount = rowsCount;
+    pool->start = start;
+    pool->direction = direction;
+    pool->chunksCount = (rowsCount + SEARCH_CHUNK_ROWS - 1) / SEARCH_CHUNK_ROWS;
+
+    if ((size_t)pool->chunksCount > pool->chunksSize)
+    {
+        pool->chunksSize = pool->chunksCount;
+        pool->chunks = realloc(pool->chunks, pool->chunksSize * sizeof(SearchChunk));
+    }
+
+    for (int i = 0; i < pool->chunksCount; i++)
+        pool->chunks[i].done = 0;
+
+    pool->nextChunk = 0;
+    pool->firstHit = pool->chunksCount;
+    pool->cancel = 0;
+
+    // the workers see the search above once they took the lock
+    pthread_mutex_lock(&pool->lock);
+    pool->generation++;
+    pool->active = pool->workersCount;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    return 0;
+}
+
+void searchPoolCancel(SearchPool *pool)
+{
+    __atomic_store_n(&pool->cancel, 1, __ATOMIC_RELAXED);
+    searchPoolWait(pool);
+}
+
+void searchPoolWait(SearchPool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+
+    while (pool->active > 0)
+        pthread_cond_wait(&pool->idle, &pool->lock);
+
+    pthread_mutex_unlock(&pool->lock);
+}
+
+enum SearchStatus searchPoolResult(SearchPool *pool, int *row, int *col)
+{
+    for (int i = 0; i < pool->chunksCount; i++)
+    {
+        SearchChunk *chunk = &pool->chunks[i];
+
+        if (!__atomic_load_n(&chunk->done, __ATOMIC_ACQUIRE))
+            return SEARCH_PENDING;
+
+        if (chunk->row != -1)
+        {
+            *row = chunk->row;
+            *col = chunk->col;
+            return SEARCH_FOUND;
+        }
+    }
+
+    return SEARCH_NOT_FOUND;
+}
+
+void searchPoolAck(SearchPool *pool)
+{
+    uint64_t count;
+    read(pool->doneFd, &count, sizeof(count));
+}
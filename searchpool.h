@@ -0,0 +1,149 @@
+#ifndef SEARCH_POOL_H
+#define SEARCH_POOL_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+#include <stdint.h>
+
+#include "regex.h"
+
+#define SEARCH_MAX_WORKERS 8
+// rows scanned by a worker before it claims the next chunk, and rows of a cache block
+#define SEARCH_CHUNK_ROWS 4096
+
+/*
+* Text and length of the row at the given index. Called from the workers,
+* the rows must not change while a search runs.
+*/
+typedef const char *(*SearchRowText)(int at, size_t *len);
+
+// flags of a search
+#define SEARCH_REGEX 1       // the query is a regex pattern
+#define SEARCH_IGNORE_CASE 2 // ASCII letters match both cases
+
+enum SearchStatus
+{
+    SEARCH_PENDING,
+    SEARCH_FOUND,
+    SEARCH_NOT_FOUND
+};
+
+typedef struct SearchChunk
+{
+    int row; // first hit of the chunk in scan order, -1 if none
+    int col;
+    int done;
+} SearchChunk;
+
+/*
+* Rows that can match the query, kept from one search to the next while the
+* document version does not change. A bit is set when the row matched the
+* query of the search that last scanned it, all these queries being prefixes
+* of the current one : extending the query only needs to rescan the rows
+* whose bit is set. The bits are trusted per block of SEARCH_CHUNK_ROWS rows,
+* once the whole block was scanned by one search. A block is invalidated
+* when the query stops extending the ones its bits were computed for, e.g.
+* after a char was deleted.
+*/
+typedef struct SearchCache
+{
+    uint64_t *matches;
+    int rowsCount;
+    unsigned long version;
+    char *query; // query of the last search
+    size_t queryLen;
+    int flags;   // of the last search, the bits depend on the case being ignored
+    int blocksCount;
+    unsigned char *blockValid;
+    size_t *blockQueryLen; // longest query the bits of the block were computed for
+    int *blockScanned;     // rows of the block scanned by the current search
+} SearchCache;
+
+typedef struct SearchWorker
+{
+    pthread_t thread;
+    struct SearchPool *pool;
+    RegexMatcher matcher;  // kept from one search to the next, with its DFA states
+    unsigned regexVersion; // regex the matcher was built for, 0 if none
+} SearchWorker;
+
+/*
+* Workers searching the rows for a query in parallel. The rows are visited in
+* scan order (from start, going in direction and wrapping around), split into
+* chunks the workers claim one after the other. Each finished chunk is
+* published with its first hit, so the first hit in scan order is known as
+* soon as the chunks before it are done. Workers skip the chunks after it.
+* doneFd, an eventfd, is signaled when a hit is found and when the workers are
+* done with a search. A regex query is compiled once by the pool, each worker
+* matching it with its own matcher. Regex searches do not use the cache.
+*/
+typedef struct SearchPool
+{
+    SearchWorker workers[SEARCH_MAX_WORKERS];
+    int workersCount;
+    pthread_mutex_t lock;
+    pthread_cond_t wake; // a search was started
+    pthread_cond_t idle; // the last worker left the search
+    unsigned generation; // incremented by each search
+    int active;          // workers still in the current search
+    int doneFd;
+
+    // the current search, read only for the workers
+    SearchRowText rowText;
+    int rowsCount;
+    int start;
+    int direction;
+    char *query;
+    size_t queryLen;
+    int flags;
+    int chunksCount;
+    SearchChunk *chunks;
+    size_t chunksSize;
+
+    int nextChunk; // next chunk to claim
+    int firstHit;  // chunk of the first hit found so far, chunksCount if none
+    int cancel;
+
+    Regex regex; // compiled from query when the SEARCH_REGEX flag is set
+    int regexCompiled;
+    unsigned regexVersion; // incremented by each compilation
+
+    SearchCache cache;
+} SearchPool;
+
+/*
+* Start one worker per CPU, up to SEARCH_MAX_WORKERS. Returns -1 on error.
+*/
+int searchPoolInit(SearchPool *pool);
+
+/*
+* Cancel the current search if any and start searching for query. version
+* identifies the content of the rows, the cache is dropped when it changes.
+* Returns -1 without starting if query is an invalid regex, pool->regex.error
+* telling why.
+*/
+int searchPoolStart(SearchPool *pool, SearchRowText rowText, int rowsCount, unsigned long version,
+                    int start, int direction, const char *query, size_t queryLen, int flags);
+
+/*
+* Stop the current search and wait until no worker reads the rows anymore.
+*/
+void searchPoolCancel(SearchPool *pool);
+
+/*
+* Wait until the workers are done with the current search.
+*/
+void searchPoolWait(SearchPool *pool);
+
+/*
+* First hit in scan order of the current search, once it is known.
+*/
+enum SearchStatus searchPoolResult(SearchPool *pool, int *row, int *col);
+
+/*
+* Reset doneFd once it was signaled.
+*/
+void searchPoolAck(SearchPool *pool);
+
+#endif
@@ -1,20 +1,84 @@
 #include <string.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
 #include "stringbuffer.h"
 
-void sbAppend(StringBuffer *sb, const char *s, const unsigned int len)
+#define SB_MIN_CAPACITY 64
+
+int sbReserve(StringBuffer *sb, const unsigned int len)
 {
-    char *new = realloc(sb->s, sb->len + len);
+    if (sb->cap - sb->len >= len)
+        return 0;
+
+    unsigned int cap = sb->cap ? sb->cap : SB_MIN_CAPACITY;
+
+    while (cap - sb->len < len)
+        cap *= 2;
+
+    char *new = realloc(sb->s, cap);
 
     if (new == NULL)
-        return;
+        return -1;
 
-    memcpy(&new[sb->len], s, len);
     sb->s = new;
+    sb->cap = cap;
+
+    return 0;
+}
+
+void sbAppend(StringBuffer *sb, const char *s, const unsigned int len)
+{
+    if (sbReserve(sb, len) == -1)
+        return;
+
+    memcpy(&sb->s[sb->len], s, len);
+    sb->len += len;
+}
+
+void sbFill(StringBuffer *sb, const char c, const unsigned int count)
+{
+    if (sbReserve(sb, count) == -1)
+        return;
+
+    memset(&sb->s[sb->len], c, count);
+    sb->len += count;
+}
+
+void sbAppendf(StringBuffer *sb, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(sb->s ? &sb->s[sb->len] : NULL, sb->cap - sb->len, fmt, ap);
+    va_end(ap);
+
+    if (len < 0)
+        return;
+
+    // did not fit, grow and format again (+1 for the terminating NUL)
+    if ((unsigned int)len >= sb->cap - sb->len)
+    {
+        if (sbReserve(sb, len + 1) == -1)
+            return;
+
+        va_start(ap, fmt);
+        vsnprintf(&sb->s[sb->len], sb->cap - sb->len, fmt, ap);
+        va_end(ap);
+    }
+
     sb->len += len;
 }
 
+void sbReset(StringBuffer *sb)
+{
+    sb->len = 0;
+}
+
 void sbFree(StringBuffer *sb)
 {
     free(sb->s);
-}
\ No newline at end of file
+
+    sb->s = NULL;
+    sb->len = 0;
+    sb->cap = 0;
+}
@@ -1,18 +1,42 @@
 #ifndef STRING_BUFFER_H
 #define STRING_BUFFER_H
 
-#define SB_INIT \
-    {           \
-        NULL, 0 \
+#define SB_INIT    \
+    {              \
+        NULL, 0, 0 \
     }
 
 typedef struct StringBuffer
 {
     char *s;
     unsigned int len;
+    unsigned int cap;
 } StringBuffer;
 
+/*
+* Make room for at least len more bytes. The capacity grows geometrically so
+* that appending n bytes one by one costs O(log n) reallocations.
+* Returns -1 if the allocation failed.
+*/
+int sbReserve(StringBuffer *sb, const unsigned int len);
+
 void sbAppend(StringBuffer *sb, const char *s, const unsigned int len);
+
+/*
+* Append count copies of c.
+*/
+void sbFill(StringBuffer *sb, const char c, const unsigned int count);
+
+/*
+* printf-like append, formatted straight into the buffer.
+*/
+void sbAppendf(StringBuffer *sb, const char *fmt, ...);
+
+/*
+* Empty the buffer but keep its memory for the next use.
+*/
+void sbReset(StringBuffer *sb);
+
 void sbFree(StringBuffer *sb);
 
-#endif
\ No newline at end of file
+#endif
@@ -1,6 +1,7 @@
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "terminal.h"
 
@@ -31,6 +32,16 @@ int disableRawMode(struct termios *t)
     return 0;
 }
 
+int enableBracketedPaste()
+{
+    return write(STDOUT_FILENO, "\x1b[?2004h", 8) == 8 ? 0 : -1;
+}
+
+int disableBracketedPaste()
+{
+    return write(STDOUT_FILENO, "\x1b[?2004l", 8) == 8 ? 0 : -1;
+}
+
 int getWindowSize(int *rows, int *cols)
 {
     struct winsize ws;
@@ -83,10 +94,37 @@ int getCursorPosition(int *rows, int *cols)
     return 0;
 }
 
+int querySynchronizedOutput()
+{
+    if (write(STDOUT_FILENO, "\x1b[?2026$p\x1b[c", 12) != 12)
+        return 0;
+
+    char buf[64];
+    unsigned int i = 0;
+
+    // read up to the end of the DA1 reply, the DECRQM reply comes first if any
+    while (i < sizeof(buf) - 1)
+    {
+        if (read(STDIN_FILENO, &buf[i], 1) != 1)
+            break;
+
+        if (buf[i++] == 'c')
+            break;
+    }
+
+    buf[i] = '\0';
+
+    // reply is ESC [ ? 2026 ; Ps $ y with Ps 1 (set) or 2 (reset) when supported
+    const char *reply = strstr(buf, "\x1b[?2026;");
+
+    if (reply == NULL)
+        return 0;
+
+    return (reply[8] == '1' || reply[8] == '2') && reply[9] == '$';
+}
+
 void clearScreeen()
 {
-    // clear the screen
-    write(STDOUT_FILENO, "\x1b[2J", 4);
-    // reposition the cursor to the top left corner
-    write(STDOUT_FILENO, "\x1b[H", 3);
+    // clear the screen and reposition the cursor to the top left corner
+    write(STDOUT_FILENO, "\x1b[2J\x1b[H", 7);
 }
\ No newline at end of file
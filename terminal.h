@@ -16,6 +16,14 @@ int enableRawMode(struct termios *t);
 */
 int disableRawMode(struct termios *t);
 
+/*
+* Bracketed paste mode (DEC private mode 2004) : the terminal surrounds pasted
+* text with ESC [ 200 ~ and ESC [ 201 ~ so that it can be told from typed keys.
+*/
+int enableBracketedPaste();
+
+int disableBracketedPaste();
+
 /*
 * Use ioctl with TIOCGWINSZ flag to retrieve the terminals number of rows and cols.
 * We use a fallback in case ioctl fails on some systems by moving the cursor to the bottom
@@ -30,6 +38,14 @@ int getWindowSize(int *rows, int *cols);
  */
 int getCursorPosition(int *rows, int *cols);
 
+/*
+* Ask the terminal whether it supports synchronized output (DEC private mode 2026)
+* with a DECRQM request. It is followed by a primary device attributes (DA1)
+* request that every terminal answers, so we never wait for a reply that will
+* not come. Returns 1 if the mode is supported, 0 otherwise.
+*/
+int querySynchronizedOutput();
+
 /*
 * We use VT100 escape char 0x1b (27) followed by a [ and one or two more bytes 
 * depending on the sequence to clear part of the screen and move the cursor.
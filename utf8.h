@@ -0,0 +1,39 @@
+#ifndef UTF8_H
+#define UTF8_H
+
+#include <stddef.h>
+
+#define UTF8_REPLACEMENT_CHAR 0xFFFD
+
+/*
+* Decode the UTF-8 sequence at the start of s (len > 0). Returns its length in
+* bytes and stores the code point. An invalid or truncated sequence decodes as
+* a single byte with the code point UTF8_REPLACEMENT_CHAR.
+*/
+int utf8Decode(const char *s, size_t len, unsigned int *codepoint);
+
+/*
+* Encode a code point, out must have room for 4 bytes. Returns the length.
+*/
+int utf8Encode(unsigned int codepoint, char *out);
+
+/*
+* Number of terminal columns taken by a code point, like wcwidth but with
+* compiled in tables so that it does not depend on the locale : 0 for
+* combining and zero width chars, 2 for East Asian wide and fullwidth chars,
+* 1 otherwise.
+*/
+int utf8Width(unsigned int codepoint);
+
+/*
+* Returns 1 if the len bytes of s are all ASCII. Vectorized with SSE2 or NEON
+* when available.
+*/
+int utf8IsAscii(const char *s, size_t len);
+
+/*
+* Returns 1 if c is a continuation byte of a multi-byte sequence.
+*/
+#define UTF8_IS_CONTINUATION(c) (((unsigned char)(c) & 0xC0) == 0x80)
+
+#endif